@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "mlp.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+// millions of evaluations of f per second over x, best of several passes
+template<typename F>
+auto throughput(const std::vector<double>& x, F&& f) -> double
+{
+  auto y = std::vector<double>(x.size());
+  auto best = std::chrono::duration<double>::max();
+  for (int pass = 0; pass < 8; ++pass)
+  {
+    const auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < x.size(); ++i)
+      y[i] = f(x[i]);
+    best = std::min<std::chrono::duration<double>>(best, std::chrono::steady_clock::now() - begin);
+
+    volatile auto sink = y[pass];
+    static_cast<void>(sink);
+  }
+  return static_cast<double>(x.size()) / best.count() * 1e-6;
+}
+
+// gigabytes per second read and written by f on an N x N matrix of doubles, best of
+// several passes of at least a millisecond
+template<typename F>
+auto bandwidth(std::size_t n, F&& f) -> double
+{
+  auto best = std::chrono::duration<double>::max();
+  for (int pass = 0; pass < 8; ++pass)
+  {
+    auto calls = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>{};
+    for (; elapsed < std::chrono::milliseconds{1}; elapsed = std::chrono::steady_clock::now() - begin)
+    {
+      f();
+      ++calls;
+    }
+    best = std::min(best, elapsed / calls);
+  }
+  return 2.0 * static_cast<double>(n * n * sizeof(double)) / best.count() * 1e-9;
+}
+
+template<std::size_t N>
+void transposes()
+{
+  using namespace mlp;
+
+  const auto a = std::make_unique<mat<double, N, N>>();
+  const auto b = std::make_unique<mat<double, N, N>>();
+  for (std::size_t i = 0; i < N; ++i)
+    for (std::size_t j = 0; j < N; ++j)
+      (*a)[i][j] = static_cast<double>(i * N + j);
+
+  const auto naive = bandwidth(N, [&]{
+    for (std::size_t i = 0; i < N; ++i)
+      for (std::size_t j = 0; j < N; ++j)
+        (*b)[j][i] = (*a)[i][j];
+  });
+  // the kernel behind transpose(), which would also copy its result into b
+  const auto blocked = bandwidth(N, [&]{ detail::kernel::transpose((*a)[0].data(), N, N, N, (*b)[0].data(), N); });
+  const auto inplace = bandwidth(N, [&]{ transpose_inplace(*b); });
+
+  volatile auto sink = (*b)[N - 1][0];
+  static_cast<void>(sink);
+  std::cout << '\t' << N << ": naive " << naive << ", blocked " << blocked << ", in place " << inplace << '\n';
+}
+
+int main()
+{
+  using namespace mlp;
+
+  // inputs spread over the table range and past it
+  auto x = std::vector<double>(std::size_t{1} << 20);
+  for (std::size_t i = 0; i < x.size(); ++i)
+    x[i] = -20.0 + 40.0 * static_cast<double>(i * 7919 % x.size()) / static_cast<double>(x.size());
+
+  std::cout << std::fixed << std::setprecision(1) << "activation throughput, Meval/s: \n";
+  std::cout << "\tsigmoid table " << throughput(x, activation<act::Sigmoid, actmode::Table, double>) <<
+    ", series " << throughput(x, activation<act::Sigmoid, actmode::Exact, double>) <<
+    ", libm " << throughput(x, [](double x_i){ return 1.0 / (1.0 + std::exp(-x_i)); }) << '\n';
+  std::cout << "\ttanh table " << throughput(x, activation<act::Tanh, actmode::Table, double>) <<
+    ", series " << throughput(x, activation<act::Tanh, actmode::Exact, double>) <<
+    ", libm " << throughput(x, [](double x_i){ return std::tanh(x_i); }) << '\n';
+  std::cout << std::scientific << std::setprecision(2) << "table max error: \n" <<
+    "\tsigmoid " << actlut<act::Sigmoid>::error << ", tanh " << actlut<act::Tanh>::error << '\n';
+
+  std::cout << std::fixed << std::setprecision(1) << "transpose bandwidth of N x N doubles, GB/s: \n";
+  transposes<64>();
+  transposes<128>();
+  transposes<256>();
+  transposes<512>();
+}
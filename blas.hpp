@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "matrix.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/*
+ * blas calibration
+ *
+ * times square matrix-vector and matrix-matrix products with the in-library kernels
+ * and with CBLAS and moves the crossover to the smallest number of multiply-adds
+ * from which CBLAS is faster for every larger measured shape. The measurements force
+ * the dispatch on the calibrating thread only, other threads keep the shared crossover
+ */
+namespace mlp::blas
+{
+struct timing
+{
+  std::size_t m;
+  std::size_t n;
+  std::size_t p;
+  double native;
+  double cblas;
+};
+
+namespace detail
+{
+// nanoseconds per call, the best of several runs of at least a millisecond
+template<typename F>
+auto measure(F&& f) -> double
+{
+  using clock = std::chrono::steady_clock;
+
+  auto best = std::numeric_limits<double>::max();
+  for (int run = 0; run < 5; ++run)
+  {
+    auto calls = std::size_t{};
+    const auto start = clock::now();
+    auto elapsed = clock::duration{};
+    for (; elapsed < std::chrono::milliseconds{1}; elapsed = clock::now() - start)
+    {
+      f();
+      ++calls;
+    }
+    best = std::min(best, std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(calls));
+  }
+  return best;
+}
+
+template<typename F>
+auto compare(F&& f) -> std::pair<double, double>
+{
+  const auto native = [&]{
+    const auto kernels = mlp::detail::scoped_crossover{std::numeric_limits<std::size_t>::max()};
+    return measure(f);
+  }();
+  const auto cblas = [&]{
+    const auto all = mlp::detail::scoped_crossover{0};
+    return measure(f);
+  }();
+  return {native, cblas};
+}
+
+template<std::size_t N>
+auto gemv() -> timing
+{
+  const auto a = std::make_unique<mat<double, N, N>>();
+  const auto x = std::make_unique<vec<double, N>>();
+  a->front().fill(1.0);
+  x->fill(1.0);
+
+  auto sink = 0.0;
+  const auto [native, cblas] = compare([&]{ sink += (*a * *x)[N - 1]; });
+  [[maybe_unused]] const volatile auto kept = sink;
+  return {N, N, 1, native, cblas};
+}
+
+template<std::size_t N>
+auto gemm() -> timing
+{
+  const auto a = std::make_unique<mat<double, N, N>>();
+  const auto b = std::make_unique<mat<double, N, N>>();
+  const auto c = std::make_unique<mat<double, N, N>>();
+  a->front().fill(1.0);
+  b->front().fill(1.0);
+
+  const auto [native, cblas] = compare([&]{ *c = *a * *b; });
+  [[maybe_unused]] const volatile auto kept = (*c)[N - 1][N - 1];
+  return {N, N, N, native, cblas};
+}
+
+template<std::size_t... E>
+auto shapes(std::index_sequence<E...>) -> std::vector<timing>
+{
+  return {gemv<(std::size_t{8} << E)>()..., gemm<(std::size_t{4} << E)>()...};
+}
+} // namespace detail
+
+inline auto calibrate() -> std::vector<timing>
+{
+  if constexpr (!enabled())
+    return {};
+  else
+  {
+    auto t = detail::shapes(std::make_index_sequence<8>{});
+    std::sort(t.begin(), t.end(), [](const timing& a, const timing& b){ return a.m * a.n * a.p < b.m * b.n * b.p; });
+
+    auto c = std::numeric_limits<std::size_t>::max();
+    for (auto i = t.size(); i > 0 && t[i - 1].cblas < t[i - 1].native; --i)
+      c = t[i - 1].m * t[i - 1].n * t[i - 1].p;
+    crossover(c);
+    return t;
+  }
+}
+} // namespace mlp::blas
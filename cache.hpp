@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "model.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * cache definition
+ *
+ * sharded set-associative CLOCK cache of network outputs in front of a model handle.
+ * Inputs are keyed by their values rounded to a multiple of the quantum, or by their
+ * exact bits when the quantum is zero, so near-identical inputs share the output
+ * computed for the first of them. Entries are tagged with the model version they were
+ * computed with and are treated as misses once a new version is published
+ */
+namespace mlp
+{
+template<typename Net, std::size_t S = 64, std::size_t Shards = 16>
+class cache
+{
+  static_assert(Shards > 0);
+
+  static constexpr auto ways = std::size_t{8};
+
+  using key = std::array<std::int64_t, std::tuple_size_v<input_t<Net>> + 1>;
+
+  struct entry
+  {
+    bool valid = false;
+    bool referenced = false;
+    std::uint64_t hash = 0;
+    std::size_t version = 0;
+    key k{};
+    output_t<Net> y{};
+  };
+
+  struct alignas(64) shard
+  {
+    std::mutex mutex;
+    std::vector<entry> entries;
+    std::vector<std::uint8_t> hands;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+  };
+
+public:
+  // capacity is the upper bound of the number of cached outputs
+  explicit cache(const model<Net, S>& m, std::size_t capacity = std::size_t{1} << 16, double quantum = 0.0)
+    : m{m}
+    , quantum{quantum}
+    , sets{std::max(std::size_t{1}, capacity / Shards / ways)}
+    , shards{new shard[Shards]}
+  {
+    for (std::size_t i = 0; i < Shards; ++i)
+    {
+      shards[i].entries.resize(sets * ways);
+      shards[i].hands.resize(sets);
+    }
+  }
+
+  auto forward(const input_t<Net>& x) const -> output_t<Net>
+  {
+    const auto s = m.acquire();
+    const auto k = quantize(x);
+    const auto h = hash(k);
+    auto& sh = shards[h % Shards];
+    const auto set = h / Shards % sets * ways;
+
+    {
+      const auto lock = std::lock_guard{sh.mutex};
+      if (const auto e = find(sh, set, h, s.version(), k))
+      {
+        e->referenced = true;
+        ++sh.hits;
+        return e->y;
+      }
+      ++sh.misses;
+    }
+
+    const auto y = x >> *s;
+
+    // another thread may have inserted the same key while the lock was released
+    const auto lock = std::lock_guard{sh.mutex};
+    if (!find(sh, set, h, s.version(), k))
+      sh.entries[set + victim(sh, set, s.version())] = entry{true, false, h, s.version(), k, y};
+    return y;
+  }
+
+  auto hits() const -> std::uint64_t
+  {
+    return count(&shard::hits);
+  }
+
+  auto misses() const -> std::uint64_t
+  {
+    return count(&shard::misses);
+  }
+
+private:
+  // the last element tells rounded keys from exact ones, inputs which are not finite or
+  // too large to be rounded to a 64-bit multiple of the quantum are keyed exactly
+  auto quantize(const input_t<Net>& x) const -> key
+  {
+    auto k = key{};
+    if (quantum > 0.0)
+    {
+      auto rounded = true;
+      for (std::size_t i = 0; rounded && i + 1 < k.size(); ++i)
+      {
+        const auto q_i = static_cast<double>(x[i]) / quantum;
+        rounded = std::isfinite(q_i) && std::abs(q_i) < 0x1p62;
+        if (rounded)
+          k[i] = std::llround(q_i);
+      }
+      if (rounded)
+        return k;
+    }
+
+    for (std::size_t i = 0; i + 1 < k.size(); ++i)
+    {
+      const auto x_i = static_cast<double>(x[i]);
+      std::memcpy(&k[i], &x_i, sizeof(x_i));
+    }
+    k.back() = 1;
+    return k;
+  }
+
+  static auto hash(const key& k) -> std::uint64_t
+  {
+    auto h = std::uint64_t{0x9e3779b97f4a7c15};
+    for (const auto k_i : k)
+    {
+      h ^= static_cast<std::uint64_t>(k_i) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+      h = (h ^ (h >> 31)) * 0xbf58476d1ce4e5b9;
+    }
+    return h ^ (h >> 29);
+  }
+
+  static auto find(shard& sh, std::size_t set, std::uint64_t h, std::size_t version, const key& k) -> entry*
+  {
+    for (std::size_t w = set; w < set + ways; ++w)
+    {
+      auto& e = sh.entries[w];
+      if (e.valid && e.hash == h && e.version == version && e.k == k)
+        return &e;
+    }
+    return nullptr;
+  }
+
+  // CLOCK over the ways of a set, prefers empty and stale entries
+  static auto victim(shard& sh, std::size_t set, std::size_t version) -> std::size_t
+  {
+    for (std::size_t w = 0; w < ways; ++w)
+      if (!sh.entries[set + w].valid || sh.entries[set + w].version != version)
+        return w;
+
+    for (auto& hand = sh.hands[set / ways];; hand = (hand + 1) % ways)
+    {
+      auto& e = sh.entries[set + hand];
+      if (!e.referenced)
+      {
+        const auto w = hand;
+        hand = (hand + 1) % ways;
+        return w;
+      }
+      e.referenced = false;
+    }
+  }
+
+  auto count(std::uint64_t shard::* counter) const -> std::uint64_t
+  {
+    auto n = std::uint64_t{};
+    for (std::size_t i = 0; i < Shards; ++i)
+    {
+      const auto lock = std::lock_guard{shards[i].mutex};
+      n += shards[i].*counter;
+    }
+    return n;
+  }
+
+  const model<Net, S>& m;
+  const double quantum;
+  const std::size_t sets;
+  const std::unique_ptr<shard[]> shards;
+};
+} // namespace mlp
+
+/*
+ * cache data forwarding operations
+ */
+namespace mlp
+{
+template<typename Net, std::size_t S, std::size_t Shards>
+auto operator>>(const input_t<Net>& x, const cache<Net, S, Shards>& c) -> output_t<Net>
+{
+  return c.forward(x);
+}
+} // namespace mlp
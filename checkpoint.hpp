@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "mlp.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * checkpoint fields
+ *
+ * the parameters of every layer type are written array by array and row by row, so that
+ * the file holds no padding and the activations and modes of a loaded network are the
+ * ones of the network it is loaded into
+ */
+namespace mlp::detail
+{
+template<typename L>
+struct saved;
+
+template<std::size_t I, std::size_t O, typename T>
+struct saved<layer<I, O, T>>
+{
+  template<typename L, typename F>
+  static void fields(L& l, F&& f)
+  {
+    f(l.w);
+    f(l.b);
+  }
+};
+
+template<std::size_t I, std::size_t O, typename T>
+struct saved<binlayer<I, O, T>>
+{
+  template<typename L, typename F>
+  static void fields(L& l, F&& f)
+  {
+    f(l.w);
+    f(l.b);
+    f(l.p);
+    f(l.s);
+  }
+};
+
+template<std::size_t V, std::size_t D, typename T>
+struct saved<embedding<V, D, T>>
+{
+  template<typename L, typename F>
+  static void fields(L& l, F&& f)
+  {
+    f(l.w);
+  }
+};
+
+template<typename A>
+inline constexpr auto nested = false;
+
+template<typename T, std::size_t M>
+inline constexpr auto nested<std::array<T, M>> = true;
+
+// calls f(data, bytes) for the innermost rows of a vec or a mat
+template<typename A, typename F>
+void each_row(A& a, F& f)
+{
+  using T = std::remove_const_t<typename A::value_type>;
+  if constexpr (nested<T>)
+    for (auto& r : a)
+      each_row(r, f);
+  else
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    f(a.data(), a.size() * sizeof(T));
+  }
+}
+
+// calls f(data, bytes) for all the saved rows of a network in order
+template<typename Net, typename F>
+void serialize(Net& net, F&& f)
+{
+  std::apply([&f](auto&... ls){
+    (saved<std::decay_t<decltype(ls)>>::fields(ls, [&f](auto& a){ each_row(a, f); }), ...);
+  }, net);
+}
+} // namespace mlp::detail
+
+/*
+ * checkpoint definition
+ *
+ * asynchronous writer of network snapshots to a file. A save only copies the network
+ * into a staging buffer, a background thread writes the last staged copy to a
+ * temporary file, syncs it and renames it over the checkpoint so that the file always
+ * holds a complete snapshot. Staged copies which are superseded before the writer gets
+ * to them are dropped. Write errors are rethrown by the next save or wait
+ */
+namespace mlp
+{
+template<typename Net>
+class checkpoint
+{
+  struct state
+  {
+    Net net;
+    std::size_t epoch;
+  };
+
+  struct header
+  {
+    char magic[8];
+    std::uint64_t epoch;
+    std::uint64_t size;
+    std::uint64_t hash;
+  };
+
+  static constexpr char magic[8] = {'m', 'l', 'p', 'c', 'k', 'p', 't', '1'};
+
+public:
+  explicit checkpoint(std::string path)
+    : path{std::move(path)}
+    , writer{[this]{ work(); }}
+  {}
+
+  checkpoint(const checkpoint&) = delete;
+  auto operator=(const checkpoint&) -> checkpoint& = delete;
+
+  // writes the pending snapshot and stops the writer
+  ~checkpoint()
+  {
+    {
+      const auto lock = std::lock_guard{mutex};
+      stop = true;
+    }
+    wake.notify_one();
+    writer.join();
+  }
+
+  // stages a copy of the network trained for the given number of epochs or steps
+  void save(const Net& net, std::size_t epoch)
+  {
+    {
+      const auto lock = std::lock_guard{mutex};
+      rethrow();
+      if (staged)
+      {
+        staged->net = net;
+        staged->epoch = epoch;
+      }
+      else
+        staged.reset(new state{net, epoch});
+      dirty = true;
+    }
+    wake.notify_one();
+  }
+
+  // waits until the last staged snapshot is on disk
+  void wait()
+  {
+    auto lock = std::unique_lock{mutex};
+    done.wait(lock, [this]{ return !dirty && !busy; });
+    rethrow();
+  }
+
+  // reads the snapshot into net and returns its epoch, nothing if there is no valid one
+  auto load(Net& net) const -> std::optional<std::size_t>
+  {
+    auto h = header{};
+    auto payload = std::vector<unsigned char>(bytes(net));
+
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return std::nullopt;
+    const auto complete = read(fd, &h, sizeof(h)) && read(fd, payload.data(), payload.size());
+    ::close(fd);
+
+    if (!complete || std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.size != payload.size() || h.hash != hash(payload))
+      return std::nullopt;
+
+    auto k = std::size_t{};
+    detail::serialize(net, [&](void* p, std::size_t n){
+      std::memcpy(p, payload.data() + k, n);
+      k += n;
+    });
+    return h.epoch;
+  }
+
+private:
+  static auto bytes(const Net& net) -> std::size_t
+  {
+    auto n = std::size_t{};
+    detail::serialize(net, [&n](const void*, std::size_t n_r){ n += n_r; });
+    return n;
+  }
+
+  // FNV-1a
+  static auto hash(const std::vector<unsigned char>& b) -> std::uint64_t
+  {
+    auto h = std::uint64_t{0xcbf29ce484222325};
+    for (const auto c : b)
+      h = (h ^ c) * 0x100000001b3;
+    return h;
+  }
+
+  static auto read(int fd, void* p, std::size_t n) -> bool
+  {
+    for (auto c = static_cast<unsigned char*>(p); n > 0;)
+    {
+      const auto r = ::read(fd, c, n);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        return false;
+      c += r;
+      n -= static_cast<std::size_t>(r);
+    }
+    return true;
+  }
+
+  static void write(int fd, const void* p, std::size_t n)
+  {
+    for (auto c = static_cast<const unsigned char*>(p); n > 0;)
+    {
+      const auto r = ::write(fd, c, n);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r < 0)
+        throw std::system_error(errno, std::generic_category(), "checkpoint write");
+      c += r;
+      n -= static_cast<std::size_t>(r);
+    }
+  }
+
+  void write(const state& s) const
+  {
+    auto payload = std::vector<unsigned char>{};
+    payload.reserve(bytes(s.net));
+    detail::serialize(s.net, [&payload](const void* p, std::size_t n){
+      const auto c = static_cast<const unsigned char*>(p);
+      payload.insert(payload.end(), c, c + n);
+    });
+
+    auto h = header{};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.epoch = s.epoch;
+    h.size = payload.size();
+    h.hash = hash(payload);
+
+    const auto tmp = path + ".tmp";
+    const auto fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "checkpoint open");
+    try
+    {
+      write(fd, &h, sizeof(h));
+      write(fd, payload.data(), payload.size());
+      if (::fsync(fd) != 0)
+        throw std::system_error(errno, std::generic_category(), "checkpoint fsync");
+    }
+    catch (...)
+    {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+      throw std::system_error(errno, std::generic_category(), "checkpoint rename");
+
+    // the rename itself is durable once the directory is synced
+    const auto slash = path.find_last_of('/');
+    const auto dir = slash == std::string::npos ? std::string{"."} : path.substr(0, slash + 1);
+    if (const auto d = ::open(dir.c_str(), O_RDONLY); d >= 0)
+    {
+      ::fsync(d);
+      ::close(d);
+    }
+  }
+
+  void work()
+  {
+    for (auto lock = std::unique_lock{mutex};;)
+    {
+      wake.wait(lock, [this]{ return stop || dirty; });
+      if (!dirty)
+        return;
+
+      std::swap(staged, written);
+      dirty = false;
+      busy = true;
+      lock.unlock();
+
+      auto e = std::exception_ptr{};
+      try
+      {
+        write(*written);
+      }
+      catch (...)
+      {
+        e = std::current_exception();
+      }
+
+      lock.lock();
+      if (e)
+        error = e;
+      busy = false;
+      done.notify_all();
+    }
+  }
+
+  void rethrow()
+  {
+    if (error)
+      std::rethrow_exception(std::exchange(error, nullptr));
+  }
+
+  const std::string path;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::unique_ptr<state> staged;
+  std::unique_ptr<state> written;
+  std::exception_ptr error;
+  bool dirty = false;
+  bool busy = false;
+  bool stop = false;
+  std::thread writer;
+};
+} // namespace mlp
+
+/*
+ * mlp training with checkpoints
+ *
+ * with a nonzero fitparms::interval the network is saved every interval epochs and after
+ * the last one, and training continues from the snapshot found at the checkpoint path if
+ * there is one, so that an interrupted run resumed with the same arguments gives the same
+ * network. Without an interval the checkpoint is neither read nor written
+ */
+namespace mlp
+{
+template<typename X, typename T, std::size_t N, std::size_t O, typename... Ls>
+auto fit(const mlp<Ls...>& net, const fitparms& par, const vec<X, N>& x, const mat<T, N, O>& y, checkpoint<mlp<Ls...>>& c) -> mlp<Ls...>
+{
+  auto fnet = net;
+  auto first = std::size_t{1};
+  if (par.interval > 0)
+    if (const auto epoch = c.load(fnet))
+      first = *epoch + 1;
+
+  for (auto epoch = first; epoch <= par.epochs; ++epoch)
+  {
+    for (std::size_t n = 0; n < N; ++n)
+      backpropagate(fnet, par, x[n], y[n]);
+    if (par.interval > 0 && (epoch % par.interval == 0 || epoch == par.epochs))
+      c.save(fnet, epoch);
+  }
+  c.wait();
+  return fnet;
+}
+} // namespace mlp
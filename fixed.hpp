@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+/*
+ * fixed definition
+ *
+ * signed fixed-point number with IntBits integer bits and FracBits fractional bits
+ * on top of the sign bit. All arithmetic is saturating, multiplication and division
+ * round to the nearest representable value
+ */
+namespace mlp
+{
+template<int IntBits, int FracBits>
+struct fixed
+{
+  static_assert(IntBits >= 1 && FracBits >= 0);
+  static_assert(IntBits + FracBits <= 31 && FracBits <= 30);
+
+  using rep = std::conditional_t<(IntBits + FracBits <= 15), std::int16_t, std::int32_t>;
+  using wide = std::conditional_t<(IntBits + FracBits <= 15), std::int32_t, std::int64_t>;
+
+  // raw bounds of the format, rep may have spare bits above IntBits + FracBits
+  static constexpr auto one = std::int64_t{1} << FracBits;
+  static constexpr auto max = (std::int64_t{1} << (IntBits + FracBits)) - 1;
+  static constexpr auto min = -(std::int64_t{1} << (IntBits + FracBits));
+
+  rep raw{};
+
+  constexpr fixed() = default;
+
+  constexpr fixed(double x)
+    : raw{static_cast<rep>(
+      !(x * one < static_cast<double>(max)) ? max :
+      !(x * one > static_cast<double>(min)) ? min :
+      static_cast<std::int64_t>(x * one + (x < 0.0 ? -0.5 : 0.5)))}
+  {}
+
+  template<typename I, typename = std::enable_if_t<std::is_integral_v<I>>>
+  constexpr fixed(I x)
+    : fixed{static_cast<double>(x)}
+  {}
+
+  static constexpr auto from_raw(std::int64_t r) -> fixed
+  {
+    auto f = fixed{};
+    f.raw = static_cast<rep>(r < min ? min : max < r ? max : r);
+    return f;
+  }
+
+  explicit constexpr operator double() const
+  {
+    return static_cast<double>(raw) / static_cast<double>(one);
+  }
+
+  friend constexpr auto operator+(fixed a, fixed b) -> fixed
+  {
+    return from_raw(wide{a.raw} + wide{b.raw});
+  }
+
+  friend constexpr auto operator-(fixed a, fixed b) -> fixed
+  {
+    return from_raw(wide{a.raw} - wide{b.raw});
+  }
+
+  friend constexpr auto operator-(fixed a) -> fixed
+  {
+    return from_raw(-wide{a.raw});
+  }
+
+  friend constexpr auto operator*(fixed a, fixed b) -> fixed
+  {
+    if constexpr (FracBits == 0)
+      return from_raw(wide{a.raw} * wide{b.raw});
+    else
+      return from_raw((wide{a.raw} * wide{b.raw} + static_cast<wide>(one >> 1)) >> FracBits);
+  }
+
+  friend constexpr auto operator/(fixed a, fixed b) -> fixed
+  {
+    if (b.raw == 0)
+      return from_raw(a.raw < 0 ? min : max);
+
+    const auto n = std::int64_t{a.raw} * one;
+    const auto d = std::int64_t{b.raw};
+    return from_raw(((n < 0) == (d < 0) ? n + d / 2 : n - d / 2) / d);
+  }
+
+  constexpr auto operator+=(fixed b) -> fixed& { return *this = *this + b; }
+  constexpr auto operator-=(fixed b) -> fixed& { return *this = *this - b; }
+  constexpr auto operator*=(fixed b) -> fixed& { return *this = *this * b; }
+  constexpr auto operator/=(fixed b) -> fixed& { return *this = *this / b; }
+
+  friend constexpr auto operator==(fixed a, fixed b) -> bool { return a.raw == b.raw; }
+  friend constexpr auto operator!=(fixed a, fixed b) -> bool { return a.raw != b.raw; }
+  friend constexpr auto operator<(fixed a, fixed b) -> bool { return a.raw < b.raw; }
+  friend constexpr auto operator<=(fixed a, fixed b) -> bool { return a.raw <= b.raw; }
+  friend constexpr auto operator>(fixed a, fixed b) -> bool { return a.raw > b.raw; }
+  friend constexpr auto operator>=(fixed a, fixed b) -> bool { return a.raw >= b.raw; }
+};
+} // namespace mlp
+
+/*
+ * fixed math functions
+ *
+ * integer-only implementations evaluated in Q2.30 and rounded to the target format
+ */
+namespace mlp
+{
+namespace detail
+{
+constexpr auto q30 = std::int64_t{1} << 30;
+constexpr auto ln2_q30 = std::int64_t{744261118};
+
+template<int I, int F>
+constexpr auto to_q30(fixed<I, F> x) -> std::int64_t
+{
+  return std::int64_t{x.raw} * (std::int64_t{1} << (30 - F));
+}
+
+template<int I, int F>
+constexpr auto from_q30(std::int64_t x) -> fixed<I, F>
+{
+  constexpr auto s = 30 - F;
+  if constexpr (s == 0)
+    return fixed<I, F>::from_raw(x);
+  else
+    return fixed<I, F>::from_raw((x + (std::int64_t{1} << (s - 1))) >> s);
+}
+} // namespace detail
+
+template<int I, int F>
+constexpr auto exp(fixed<I, F> x) -> fixed<I, F>
+{
+  // e^x = 2^k * e^r, r = x - k * ln2 in [0, ln2)
+  const auto x_q = detail::to_q30(x);
+  const auto k = x_q / detail::ln2_q30 - (x_q % detail::ln2_q30 < 0 ? 1 : 0);
+  const auto r = x_q - k * detail::ln2_q30;
+
+  // Horner scheme of the Taylor series with 1 / n in Q2.30, r >= 0 so shifts are exact divisions
+  auto e_r = detail::q30;
+  for (int n = 12; n > 0; --n)
+    e_r = detail::q30 + (((e_r * r) >> 30) * (detail::q30 / n) >> 30);
+
+  // e_r in [1, 2) as Q2.30 scaled by 2^(k - 30 + F) into the raw representation
+  const auto s = k - 30 + F;
+  if (s >= 0)
+    return fixed<I, F>::from_raw(s >= 32 || (fixed<I, F>::max >> s) < e_r ? fixed<I, F>::max : e_r << s);
+  if (-s > 62)
+    return fixed<I, F>{};
+  return fixed<I, F>::from_raw((e_r + (std::int64_t{1} << (-s - 1))) >> -s);
+}
+
+template<int I, int F>
+constexpr auto ln(fixed<I, F> x) -> fixed<I, F>
+{
+  if (x.raw < 0)
+    throw std::invalid_argument("ln(negative)");
+  if (x.raw == 0)
+    return fixed<I, F>::from_raw(fixed<I, F>::min);
+
+  // x = 2^k * m, m in [1, 2) as Q2.30
+  auto m = std::int64_t{x.raw};
+  auto k = 30 - F;
+  for (; m >= 2 * detail::q30; m >>= 1)
+    ++k;
+  for (; m < detail::q30; m <<= 1)
+    --k;
+
+  // ln(m) = 2 * atanh((m - 1) / (m + 1))
+  const auto s = (m - detail::q30) * detail::q30 / (m + detail::q30);
+  const auto s_2 = s * s / detail::q30;
+  auto l_m = std::int64_t{};
+  auto last = s;
+  for (int n = 1; n < 24; n += 2)
+  {
+    l_m += last / n;
+    last = last * s_2 / detail::q30;
+  }
+
+  return detail::from_q30<I, F>(k * detail::ln2_q30 + 2 * l_m);
+}
+} // namespace mlp
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "mlp.hpp"
+
+#include <utility>
+
+/*
+ * layerview definition
+ *
+ * layer whose weights and biases live in an external buffer, the O rows of I weights
+ * are followed by the O biases
+ */
+namespace mlp
+{
+template<std::size_t I, std::size_t O, typename T>
+struct layerview
+{
+  act a;
+  actmode m;
+  T* w;
+
+  constexpr auto row(std::size_t o) const -> T*
+  {
+    return w + o * I;
+  }
+
+  constexpr auto bias() const -> T*
+  {
+    return w + O * I;
+  }
+};
+} // namespace mlp
+
+/*
+ * layerview operations
+ */
+namespace mlp
+{
+namespace detail
+{
+template<typename T, std::size_t I, std::size_t O, typename P>
+constexpr auto affine(const layerview<I, O, P>& l, const vec<T, I>& x) -> vec<T, O>
+{
+  auto z = vec<T, O>{};
+  for (std::size_t o = 0; o < O; ++o)
+  {
+    const auto w = l.row(o);
+    for (std::size_t i = 0; i < I; ++i)
+      z[o] = z[o] + w[i] * x[i];
+    z[o] = z[o] + l.bias()[o];
+  }
+  return z;
+}
+} // namespace detail
+
+template<typename T, std::size_t I, std::size_t O, typename P>
+constexpr auto operator>>(const vec<T, I>& x, const layerview<I, O, P>& l) -> vec<T, O>
+{
+  return activation(l.a, l.m, detail::affine(l, x));
+}
+} // namespace mlp
+
+/*
+ * flat definition
+ *
+ * network representation with the parameters of all the layers in one contiguous
+ * cache line aligned buffer laid out as by flatten, and a gradient buffer of the same
+ * layout. Layers are accessed through views so that whole-model operations like
+ * optimizer steps, averaging or checksums are single passes over the buffers
+ */
+namespace mlp
+{
+template<typename... Ls>
+struct flat
+{
+  using T = scalar_t<mlp<Ls...>>;
+
+  static constexpr auto layers = sizeof...(Ls);
+  static constexpr auto size = parameters_v<Ls...>;
+
+  // offsets of the layers in the buffers
+  static constexpr auto offsets = []{
+    const auto sizes = vec<std::size_t, layers>{detail::parameters<Ls>::size...};
+    auto o = vec<std::size_t, layers + 1>{};
+    for (std::size_t l = 0; l < layers; ++l)
+      o[l + 1] = o[l] + sizes[l];
+    return o;
+  }();
+
+  template<std::size_t L>
+  using layer_t = std::tuple_element_t<L, mlp<Ls...>>;
+
+  template<std::size_t L, typename P>
+  using view_t = layerview<detail::parameters<layer_t<L>>::inputs, detail::parameters<layer_t<L>>::outputs, P>;
+
+  vec<act, layers> a;
+  vec<actmode, layers> m;
+  alignas(64) vec<T, size> p;
+  alignas(64) vec<T, size> g;
+
+  constexpr explicit flat(const mlp<Ls...>& net)
+    : a{}
+    , m{}
+    , p{flatten(net)}
+    , g{}
+  {
+    std::apply([this](const auto&... ls){
+      auto l = std::size_t{};
+      ((a[l] = ls.a, m[l++] = ls.m), ...);
+    }, net);
+  }
+
+  template<std::size_t L>
+  constexpr auto params() const -> view_t<L, const T>
+  {
+    return {a[L], m[L], p.data() + offsets[L]};
+  }
+
+  template<std::size_t L>
+  constexpr auto params() -> view_t<L, T>
+  {
+    return {a[L], m[L], p.data() + offsets[L]};
+  }
+
+  template<std::size_t L>
+  constexpr auto grads() -> view_t<L, T>
+  {
+    return {a[L], m[L], g.data() + offsets[L]};
+  }
+
+  constexpr auto net() const -> mlp<Ls...>
+  {
+    auto n = mlp<Ls...>{Ls{act::Linear, {}, {}}...};
+    std::apply([this](auto&... ls){
+      auto l = std::size_t{};
+      ((ls.a = a[l], ls.m = m[l++]), ...);
+    }, n);
+    return unflatten(p, n);
+  }
+};
+} // namespace mlp
+
+/*
+ * flat data forwarding operations
+ */
+namespace mlp
+{
+namespace detail
+{
+template<std::size_t L = 0, typename T, std::size_t I, typename... Ls>
+constexpr auto forward(const flat<Ls...>& f, const vec<T, I>& x)
+{
+  const auto y = x >> f.template params<L>();
+  if constexpr (L + 1 == sizeof...(Ls))
+    return y;
+  else
+    return forward<L + 1>(f, y);
+}
+} // namespace detail
+
+template<typename T, std::size_t I, typename... Ls>
+constexpr auto operator>>(const vec<T, I>& x, const flat<Ls...>& f)
+{
+  return detail::forward(f, x);
+}
+
+template<typename T, std::size_t I, std::size_t N, typename... Ls>
+constexpr auto operator>>(const mat<T, N, I>& x, const flat<Ls...>& f)
+{
+  return fmap([&f](const vec<T, I>& x_n){ return x_n >> f; }, x);
+}
+} // namespace mlp
+
+/*
+ * flat training
+ *
+ * gradients are accumulated into the gradient buffer and applied by a single pass
+ */
+namespace mlp
+{
+// accumulates the loss gradient of a sample with respect to the parameters of the L-th and
+// the following layers and returns the gradient with respect to the L-th layer input for L > 0
+template<std::size_t L = 0, typename T, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto gradient(flat<Ls...>& f, lossf lf, const vec<T, I>& x, const vec<T, O>& y)
+{
+  const auto l = f.template params<L>();
+  const auto g = f.template grads<L>();
+  const auto z = detail::affine(l, x);
+  const auto a = activation(l.a, l.m, z);
+
+  auto delta = derivative(l.a, l.m, z);
+  if constexpr (L + 1 == sizeof...(Ls))
+    zip_into(std::multiplies{}, delta, derivative(lf, y, a), delta);
+  else
+    zip_into(std::multiplies{}, delta, gradient<L + 1>(f, lf, a, y), delta);
+
+  for (std::size_t o = 0; o < delta.size(); ++o)
+  {
+    const auto g_o = g.row(o);
+    for (std::size_t i = 0; i < I; ++i)
+      g_o[i] = g_o[i] + delta[o] * x[i];
+    g.bias()[o] = g.bias()[o] + delta[o];
+  }
+
+  if constexpr (L > 0)
+  {
+    auto g_x = vec<T, I>{};
+    for (std::size_t o = 0; o < delta.size(); ++o)
+      for (std::size_t i = 0; i < I; ++i)
+        g_x[i] = g_x[i] + l.row(o)[i] * delta[o];
+    return g_x;
+  }
+}
+
+// gradient descent step over the whole buffer which also clears the gradient
+template<typename... Ls>
+constexpr auto step(flat<Ls...>& f, double rate) -> flat<Ls...>&
+{
+  using T = typename flat<Ls...>::T;
+
+  zip_into([r = T(rate)](T p, T g){ return p - g * r; }, f.p, f.g, f.p);
+  f.g = {};
+  return f;
+}
+
+template<typename X, typename T, std::size_t N, std::size_t O, typename... Ls>
+constexpr auto fit(const flat<Ls...>& f, const fitparms& par, const vec<X, N>& x, const mat<T, N, O>& y) -> flat<Ls...>
+{
+  auto ff = f;
+  for (std::size_t epoch = 1; epoch <= par.epochs; ++epoch)
+    for (std::size_t n = 0; n < N; ++n)
+    {
+      gradient(ff, par.loss, x[n], y[n]);
+      step(ff, par.rate);
+    }
+  return ff;
+}
+} // namespace mlp
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "mlp.hpp"
+
+/*
+ * l-bfgs definition
+ *
+ * full-batch quasi-Newton training over the flattened parameters of a network.
+ * The objective is the sum of the losses of the outputs averaged over the samples,
+ * every iteration takes a step along the direction given by the last H corrections
+ * which satisfies the strong Wolfe conditions
+ */
+namespace mlp
+{
+struct lbfgsparms
+{
+  std::size_t iterations;
+  lossf loss;
+  double tolerance = 1e-10;
+};
+} // namespace mlp
+
+/*
+ * l-bfgs implementation
+ */
+namespace mlp::detail
+{
+template<typename T, std::size_t P>
+struct sample
+{
+  T step;
+  T f;
+  T df;
+  vec<T, P> p;
+  vec<T, P> g;
+};
+
+template<typename T, std::size_t M>
+constexpr auto dot(const vec<T, M>& a, const vec<T, M>& b) -> T
+{
+  return reduce(std::plus{}, T(0), zip(std::multiplies{}, a, b));
+}
+
+// objective value and gradient at the parameters p
+template<typename X, typename T, std::size_t N, std::size_t O, typename... Ls>
+constexpr auto objective(mlp<Ls...>& net, lossf f, const vec<T, parameters_v<Ls...>>& p, const vec<X, N>& x, const mat<T, N, O>& y)
+  -> std::pair<T, vec<T, parameters_v<Ls...>>>
+{
+  unflatten(p, net);
+
+  auto g = net;
+  unflatten(vec<T, parameters_v<Ls...>>{}, g);
+
+  auto l = T(0);
+  for (std::size_t n = 0; n < N; ++n)
+  {
+    l += loss(f, y[n], x[n] >> net) * T(O);
+    gradient(net, g, f, x[n], y[n]);
+  }
+  return {l / T(N), flatten(g) * (T(1) / T(N))};
+}
+
+// minimizer of the cubic interpolating the values and the derivatives at a and b,
+// the midpoint when it is not well inside of the interval
+template<typename T>
+constexpr auto cubic(T a, T f_a, T df_a, T b, T f_b, T df_b) -> T
+{
+  const auto d_1 = df_a + df_b - T(3) * (f_a - f_b) / (a - b);
+  const auto r = d_1 * d_1 - df_a * df_b;
+  const auto lo = a < b ? a : b;
+  const auto hi = a < b ? b : a;
+  const auto mid = (a + b) / T(2);
+  if (!(r >= T(0)))
+    return mid;
+
+  const auto d_2 = (b < a ? T(-1) : T(1)) * sqrt(r);
+  const auto den = df_b - df_a + T(2) * d_2;
+  if (den == T(0))
+    return mid;
+
+  const auto c = b - (b - a) * (df_b + d_2 - d_1) / den;
+  const auto margin = (hi - lo) / T(10);
+  return lo + margin <= c && c <= hi - margin ? c : mid;
+}
+
+// line search for a step satisfying the strong Wolfe conditions, Nocedal and Wright 3.5 and 3.6
+template<typename X, typename T, std::size_t N, std::size_t O, typename... Ls>
+constexpr auto wolfe(mlp<Ls...>& net, lossf f, const sample<T, parameters_v<Ls...>>& s_0, const vec<T, parameters_v<Ls...>>& d,
+  T step, const vec<X, N>& x, const mat<T, N, O>& y) -> std::pair<bool, sample<T, parameters_v<Ls...>>>
+{
+  constexpr auto c_1 = T(1e-4);
+  constexpr auto c_2 = T(0.9);
+
+  const auto at = [&](T a){
+    auto s = sample<T, parameters_v<Ls...>>{a, T(0), T(0), s_0.p + d * a, {}};
+    const auto [f_a, g_a] = objective(net, f, s.p, x, y);
+    s.f = f_a;
+    s.g = g_a;
+    s.df = dot(g_a, d);
+    return s;
+  };
+  const auto armijo = [&](const sample<T, parameters_v<Ls...>>& s){
+    return s.f <= s_0.f + c_1 * s.step * s_0.df;
+  };
+  const auto curvature = [&](const sample<T, parameters_v<Ls...>>& s){
+    return (s.df < T(0) ? -s.df : s.df) <= -c_2 * s_0.df;
+  };
+  const auto zoom = [&](sample<T, parameters_v<Ls...>> lo, sample<T, parameters_v<Ls...>> hi){
+    for (int i = 0; i < 32; ++i)
+    {
+      const auto s = at(cubic(lo.step, lo.f, lo.df, hi.step, hi.f, hi.df));
+      if (!armijo(s) || s.f >= lo.f)
+        hi = s;
+      else
+      {
+        if (curvature(s))
+          return std::pair{true, s};
+        if (s.df * (hi.step - lo.step) >= T(0))
+          hi = lo;
+        lo = s;
+      }
+    }
+    return std::pair{lo.step > T(0), lo};
+  };
+
+  auto prev = s_0;
+  prev.step = T(0);
+  for (int i = 0; i < 32; ++i, step *= T(2))
+  {
+    const auto s = at(step);
+    if (!armijo(s) || (i > 0 && s.f >= prev.f))
+      return zoom(prev, s);
+    if (curvature(s))
+      return std::pair{true, s};
+    if (s.df >= T(0))
+      return zoom(s, prev);
+    prev = s;
+  }
+  return std::pair{true, prev};
+}
+} // namespace mlp::detail
+
+/*
+ * l-bfgs training
+ */
+namespace mlp
+{
+template<std::size_t H = 8, typename X, typename T, std::size_t N, std::size_t O, typename... Ls>
+constexpr auto lbfgs(const mlp<Ls...>& net, const lbfgsparms& par, const vec<X, N>& x, const mat<T, N, O>& y) -> mlp<Ls...>
+{
+  static_assert(H > 0);
+  constexpr auto P = parameters_v<Ls...>;
+
+  auto fnet = net;
+  auto s = detail::sample<T, P>{T(0), T(0), T(0), flatten(net), {}};
+  const auto [f_0, g_0] = detail::objective(fnet, par.loss, s.p, x, y);
+  s.f = f_0;
+  s.g = g_0;
+
+  // ring of the last H parameter and gradient differences
+  auto ss = mat<T, H, P>{};
+  auto ys = mat<T, H, P>{};
+  auto rho = vec<T, H>{};
+  auto k = std::size_t{};
+
+  for (std::size_t it = 0; it < par.iterations; ++it)
+  {
+    const auto g_max = fold([](T m, T g_i){ return std::max(m, g_i < T(0) ? -g_i : g_i); }, T(0), s.g);
+    if (!(g_max > T(par.tolerance)))
+      break;
+
+    // two-loop recursion for the direction -H * g
+    auto d = s.g * T(-1);
+    auto alpha = vec<T, H>{};
+    const auto m = std::min(k, H);
+    for (std::size_t j = 1; j <= m; ++j)
+    {
+      const auto h = (k - j) % H;
+      alpha[h] = rho[h] * detail::dot(ss[h], d);
+      d -= ys[h] * alpha[h];
+    }
+    if (m > 0)
+    {
+      const auto h = (k - 1) % H;
+      d *= detail::dot(ss[h], ys[h]) / detail::dot(ys[h], ys[h]);
+    }
+    for (std::size_t j = m; j > 0; --j)
+    {
+      const auto h = (k - j) % H;
+      d += ss[h] * (alpha[h] - rho[h] * detail::dot(ys[h], d));
+    }
+
+    s.df = detail::dot(s.g, d);
+    if (!(s.df < T(0)))
+    {
+      k = 0;
+      d = s.g * T(-1);
+      s.df = -detail::dot(s.g, s.g);
+    }
+
+    const auto step = k == 0 ? std::min(T(1), T(1) / sqrt(-s.df)) : T(1);
+    const auto [found, next] = detail::wolfe(fnet, par.loss, s, d, step, x, y);
+    if (!found)
+      break;
+
+    // a pair without positive curvature is dropped and keeps the slot of the oldest one
+    const auto s_k = next.p - s.p;
+    const auto y_k = next.g - s.g;
+    const auto sy = detail::dot(s_k, y_k);
+    if (sy > T(0))
+    {
+      const auto h = k % H;
+      ss[h] = s_k;
+      ys[h] = y_k;
+      rho[h] = T(1) / sy;
+      ++k;
+    }
+
+    const auto change = s.f - next.f;
+    s = next;
+    if (!(change > T(par.tolerance) * std::max(T(1), s.f < T(0) ? -s.f : s.f)))
+      break;
+  }
+
+  return unflatten(s.p, fnet);
+}
+} // namespace mlp
@@ -22,7 +22,7 @@ constexpr auto pow(T x, int n) -> T
   if (n < 0)
     return T(1) / pow(x, -n);
 
-  auto x_n = 1.0;
+  auto x_n = T(1);
   for (; n > 0; n /= 2)
   {
     if (n & 1)
@@ -44,6 +44,27 @@ constexpr auto exp(double x) -> double
   return e_x;
 }
 
+constexpr auto sqrt(double x) -> double
+{
+  if (x < 0)
+    throw std::invalid_argument("sqrt(negative)");
+  if (x == 0.0 || x + x == x)
+    return x;
+
+  // x = 4^k * m, m in [1, 4)
+  auto m = x;
+  auto scale = 1.0;
+  for (; m >= 4.0; m /= 4.0)
+    scale *= 2.0;
+  for (; m < 1.0; m *= 4.0)
+    scale /= 2.0;
+
+  auto s_m = (1.0 + m) / 2.0;
+  for (int n = 0; n < 6; ++n)
+    s_m = (s_m + m / s_m) / 2.0;
+  return s_m * scale;
+}
+
 constexpr auto ln(double x) -> double
 {
   if (x < 0)
@@ -7,8 +7,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <type_traits>
+#include <utility>
+
+#if defined(MLP_USE_CBLAS)
+#include <cblas.h>
+#endif
 
 /*
  * vec definition
@@ -55,6 +63,70 @@ constexpr auto fold(F&& f, const A& z, const vec<B, M>& x) -> std::conditional_t
     return r;
   }
 }
+
+namespace detail
+{
+// pairwise summation order: halves are split recursively down to blocks which are
+// accumulated in 8 independent lanes combined as a balanced tree
+template<typename R, typename F, typename B>
+constexpr auto pairwise(F& f, const B* x, std::size_t n) -> R
+{
+  if (n < 16)
+  {
+    auto r = R{x[0]};
+    for (std::size_t i = 1; i < n; ++i)
+      r = f(r, x[i]);
+    return r;
+  }
+  if (n <= 128)
+  {
+    auto r = vec<R, 8>{};
+    for (std::size_t k = 0; k < 8; ++k)
+      r[k] = x[k];
+
+    const auto m = n / 8 * 8;
+    for (std::size_t i = 8; i < m; i += 8)
+      for (std::size_t k = 0; k < 8; ++k)
+        r[k] = f(r[k], x[i + k]);
+
+    auto s = f(f(f(r[0], r[1]), f(r[2], r[3])), f(f(r[4], r[5]), f(r[6], r[7])));
+    for (std::size_t i = m; i < n; ++i)
+      s = f(s, x[i]);
+    return s;
+  }
+
+  const auto h = n / 16 * 8;
+  return f(pairwise<R>(f, x, h), pairwise<R>(f, x + h, n - h));
+}
+} // namespace detail
+
+// unlike fold, f also combines partial results with each other in an unspecified
+// grouping, so it is to be associative and to take its result type on both sides,
+// e.g. a sum of absolute values is to reduce the mapped values with std::plus
+template<typename F, typename A, typename B, std::size_t M>
+constexpr auto reduce(F&& f, const A& z, const vec<B, M>& x) -> std::conditional_t<M == 0, A, std::invoke_result_t<F, A, B>>
+{
+  if constexpr (M == 0)
+    return z;
+  else
+    return f(z, detail::pairwise<std::invoke_result_t<F, A, B>>(f, x.data(), M));
+}
+
+template<typename F, typename A, std::size_t M>
+constexpr auto fmap_inplace(F&& f, vec<A, M>& a) -> vec<A, M>&
+{
+  for (std::size_t i = 0; i < M; ++i)
+    a[i] = f(a[i]);
+  return a;
+}
+
+template<typename F, typename A, typename B, typename C, std::size_t M>
+constexpr auto zip_into(F&& f, const vec<A, M>& a, const vec<B, M>& b, vec<C, M>& c) -> vec<C, M>&
+{
+  for (std::size_t i = 0; i < M; ++i)
+    c[i] = f(a[i], b[i]);
+  return c;
+}
 } // namespace mlp
 
 /*
@@ -79,6 +151,24 @@ constexpr auto operator*(const vec<A, M>& a, B b) -> vec<decltype(A{} * B{}), M>
 {
   return fmap([b](A a_m){ return a_m * b; }, a);
 }
+
+template<typename A, typename B, std::size_t M>
+constexpr auto operator+=(vec<A, M>& a, const vec<B, M>& b) -> vec<A, M>&
+{
+  return zip_into([](A a_m, B b_m){ return a_m + b_m; }, a, b, a);
+}
+
+template<typename A, typename B, std::size_t M>
+constexpr auto operator-=(vec<A, M>& a, const vec<B, M>& b) -> vec<A, M>&
+{
+  return zip_into([](A a_m, B b_m){ return a_m - b_m; }, a, b, a);
+}
+
+template<typename A, typename B, std::size_t M>
+constexpr auto operator*=(vec<A, M>& a, B b) -> vec<A, M>&
+{
+  return fmap_inplace([b](A a_m){ return a_m * b; }, a);
+}
 } // namespace mlp
 
 /*
@@ -114,8 +204,614 @@ constexpr auto zip(F&& f, const mat<A, M, N>& a, const mat<B, M, N>& b) -> mat<s
       c[i][j] = f(a[i][j], b[i][j]);
   return c;
 }
+
+template<typename F, typename A, std::size_t M, std::size_t N>
+constexpr auto fmap_inplace(F&& f, mat<A, M, N>& a) -> mat<A, M, N>&
+{
+  for (std::size_t i = 0; i < M; ++i)
+    for (std::size_t j = 0; j < N; ++j)
+      a[i][j] = f(a[i][j]);
+  return a;
+}
+
+template<typename F, typename A, typename B, typename C, std::size_t M, std::size_t N>
+constexpr auto zip_into(F&& f, const mat<A, M, N>& a, const mat<B, M, N>& b, mat<C, M, N>& c) -> mat<C, M, N>&
+{
+  for (std::size_t i = 0; i < M; ++i)
+    for (std::size_t j = 0; j < N; ++j)
+      c[i][j] = f(a[i][j], b[i][j]);
+  return c;
+}
+} // namespace mlp
+
+/*
+ * blas dispatch
+ *
+ * with MLP_USE_CBLAS defined, runtime float and double products of at least the
+ * crossover number of multiply-adds are computed by CBLAS. Constant evaluation and
+ * smaller products use the in-library kernels
+ */
+namespace mlp
+{
+namespace detail
+{
+constexpr auto constant_evaluated() -> bool
+{
+  return __builtin_is_constant_evaluated();
+}
+
+inline auto crossover() -> std::atomic<std::size_t>&
+{
+  static auto c = std::atomic<std::size_t>{std::size_t{1} << 16};
+  return c;
+}
+
+// crossover which takes the place of the shared one on the current thread while a
+// scoped_crossover is alive, so that other threads keep dispatching by the shared one
+inline auto local_crossover() -> const std::size_t*&
+{
+  thread_local auto c = static_cast<const std::size_t*>(nullptr);
+  return c;
+}
+
+class scoped_crossover
+{
+public:
+  explicit scoped_crossover(std::size_t n) : n{n}, was{std::exchange(local_crossover(), &this->n)} {}
+  ~scoped_crossover() { local_crossover() = was; }
+
+  scoped_crossover(const scoped_crossover&) = delete;
+  auto operator=(const scoped_crossover&) -> scoped_crossover& = delete;
+
+private:
+  const std::size_t n;
+  const std::size_t* const was;
+};
+
+inline auto current_crossover() -> std::size_t
+{
+  const auto* c = local_crossover();
+  return c ? *c : crossover().load(std::memory_order_relaxed);
+}
+
+template<typename A, typename B>
+inline constexpr auto blas_types = std::is_same_v<A, B> && (std::is_same_v<A, float> || std::is_same_v<A, double>);
+
+constexpr auto use_blas(std::size_t n) -> bool
+{
+#if defined(MLP_USE_CBLAS)
+  return !constant_evaluated() && n >= current_crossover();
+#else
+  static_cast<void>(n);
+  return false;
+#endif
+}
+
+template<typename T, std::size_t M, std::size_t N>
+void gemv(const mat<T, M, N>& a, const vec<T, N>& x, vec<T, M>& y)
+{
+  static_assert(sizeof(a) == sizeof(T) * M * N);
+#if defined(MLP_USE_CBLAS)
+  const auto m = static_cast<int>(M);
+  const auto n = static_cast<int>(N);
+  if constexpr (std::is_same_v<T, double>)
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, m, n, 1.0, a[0].data(), n, x.data(), 1, 0.0, y.data(), 1);
+  else
+    cblas_sgemv(CblasRowMajor, CblasNoTrans, m, n, 1.0f, a[0].data(), n, x.data(), 1, 0.0f, y.data(), 1);
+#else
+  static_cast<void>(a), static_cast<void>(x), static_cast<void>(y);
+#endif
+}
+
+template<typename T, std::size_t M, std::size_t N, std::size_t P>
+void gemm(const mat<T, M, N>& a, const mat<T, N, P>& b, mat<T, M, P>& c)
+{
+  static_assert(sizeof(a) == sizeof(T) * M * N && sizeof(b) == sizeof(T) * N * P);
+#if defined(MLP_USE_CBLAS)
+  const auto m = static_cast<int>(M);
+  const auto n = static_cast<int>(N);
+  const auto p = static_cast<int>(P);
+  if constexpr (std::is_same_v<T, double>)
+    cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, p, n, 1.0, a[0].data(), n, b[0].data(), p, 0.0, c[0].data(), p);
+  else
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, p, n, 1.0f, a[0].data(), n, b[0].data(), p, 0.0f, c[0].data(), p);
+#else
+  static_cast<void>(a), static_cast<void>(b), static_cast<void>(c);
+#endif
+}
+
+// c = a * transpose(b)
+template<typename T, std::size_t M, std::size_t N, std::size_t P>
+void gemm_nt(const mat<T, M, N>& a, const mat<T, P, N>& b, mat<T, M, P>& c)
+{
+  static_assert(sizeof(a) == sizeof(T) * M * N && sizeof(b) == sizeof(T) * P * N);
+#if defined(MLP_USE_CBLAS)
+  const auto m = static_cast<int>(M);
+  const auto n = static_cast<int>(N);
+  const auto p = static_cast<int>(P);
+  if constexpr (std::is_same_v<T, double>)
+    cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m, p, n, 1.0, a[0].data(), n, b[0].data(), n, 0.0, c[0].data(), p);
+  else
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, m, p, n, 1.0f, a[0].data(), n, b[0].data(), n, 0.0f, c[0].data(), p);
+#else
+  static_cast<void>(a), static_cast<void>(b), static_cast<void>(c);
+#endif
+}
+} // namespace detail
+
+namespace blas
+{
+// multiply-adds from which products go to CBLAS on the current thread
+inline auto crossover() -> std::size_t
+{
+  return detail::current_crossover();
+}
+
+inline void crossover(std::size_t n)
+{
+  detail::crossover().store(n, std::memory_order_relaxed);
+}
+
+constexpr auto enabled() -> bool
+{
+#if defined(MLP_USE_CBLAS)
+  return true;
+#else
+  return false;
+#endif
+}
+} // namespace blas
 } // namespace mlp
 
+/*
+ * kernel tunings
+ *
+ * per-shape parameters of the runtime kernels: the number of rows mat * vec computes
+ * together, the width of the column tiles of mat * mat and the number of threads the
+ * rows of a product are split over. Products of at least the tunable number of
+ * multiply-adds look their shape up in a lock-free table, smaller products and shapes
+ * without an entry use the defaults. Rows are split over threads by the executor which
+ * parallel.hpp installs, without it or inside a task of the executor they are computed
+ * sequentially
+ */
+namespace mlp
+{
+struct tiling
+{
+  std::size_t rows = 1;
+  std::size_t cols = 0; // untiled
+  std::size_t threads = 1;
+};
+
+namespace detail
+{
+inline constexpr auto tunable = std::size_t{1} << 12;
+
+class tilings
+{
+  struct slot
+  {
+    std::atomic<std::uint64_t> key{};
+    std::atomic<std::uint64_t> value{};
+  };
+
+public:
+  static constexpr auto capacity = std::size_t{256};
+
+  auto find(std::size_t m, std::size_t n, std::size_t p) const -> tiling
+  {
+    const auto k = key(m, n, p);
+    for (std::size_t i = 0, s = hash(k); k != 0 && i < capacity; ++i, s = (s + 1) % capacity)
+    {
+      const auto k_s = slots[s].key.load(std::memory_order_acquire);
+      if (k_s == k)
+        return unpack(slots[s].value.load(std::memory_order_acquire));
+      if (k_s == 0)
+        break;
+    }
+    return {};
+  }
+
+  // false if the shape is too large or the table is full
+  auto store(std::size_t m, std::size_t n, std::size_t p, const tiling& t) -> bool
+  {
+    const auto k = key(m, n, p);
+    for (std::size_t i = 0, s = hash(k); k != 0 && i < capacity; ++i, s = (s + 1) % capacity)
+    {
+      auto k_s = slots[s].key.load(std::memory_order_acquire);
+      if (k_s == 0 && slots[s].key.compare_exchange_strong(k_s, k, std::memory_order_acq_rel))
+        k_s = k;
+      if (k_s == k)
+      {
+        slots[s].value.store(pack(t), std::memory_order_release);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // calls f(m, n, p, tiling) for every stored shape
+  template<typename F>
+  void each(F&& f) const
+  {
+    for (const auto& s : slots)
+      if (const auto k = s.key.load(std::memory_order_acquire); k != 0)
+        if (const auto v = s.value.load(std::memory_order_acquire); v != 0)
+          f(k >> 42, k >> 21 & mask, k & mask, unpack(v));
+  }
+
+private:
+  static constexpr auto mask = (std::uint64_t{1} << 21) - 1;
+
+  static auto key(std::size_t m, std::size_t n, std::size_t p) -> std::uint64_t
+  {
+    if (m == 0 || n == 0 || p == 0 || m > mask || n > mask || p > mask)
+      return 0;
+    return std::uint64_t{m} << 42 | std::uint64_t{n} << 21 | std::uint64_t{p};
+  }
+
+  static auto hash(std::uint64_t k) -> std::size_t
+  {
+    return static_cast<std::size_t>((k * 0x9e3779b97f4a7c15) >> 56) % capacity;
+  }
+
+  // rows in the low 16 bits, columns and threads in 24 bits each, never zero
+  static auto pack(const tiling& t) -> std::uint64_t
+  {
+    const auto clamp = [](std::size_t v, std::size_t lo, std::uint64_t hi){ return std::uint64_t{v < lo ? lo : v < hi ? v : hi}; };
+    return clamp(t.rows, 1, 0xffff) | clamp(t.cols, 0, 0xffffff) << 16 | clamp(t.threads, 1, 0xffffff) << 40;
+  }
+
+  static auto unpack(std::uint64_t v) -> tiling
+  {
+    if (v == 0)
+      return {};
+    return {v & 0xffff, v >> 16 & 0xffffff, v >> 40};
+  }
+
+  std::array<slot, capacity> slots;
+};
+
+inline auto tunings() -> tilings&
+{
+  static auto t = tilings{};
+  return t;
+}
+
+// table which takes the place of the tunings on the current thread while a candidate
+// is measured, so that other threads keep the published ones
+inline auto trial() -> const tilings*&
+{
+  thread_local auto t = static_cast<const tilings*>(nullptr);
+  return t;
+}
+
+inline auto tuned(std::size_t m, std::size_t n, std::size_t p) -> tiling
+{
+  if (m * n * p < tunable)
+    return {};
+  const auto* t = trial();
+  return t ? t->find(m, n, p) : tunings().find(m, n, p);
+}
+
+using task = void (*)(const void*, std::size_t);
+
+// runs f(context, i) for every i in [0, n) and returns when all calls are done
+inline auto executor() -> std::atomic<void (*)(std::size_t, task, const void*)>&
+{
+  static auto e = std::atomic<void (*)(std::size_t, task, const void*)>{};
+  return e;
+}
+} // namespace detail
+} // namespace mlp
+
+/*
+ * size-generic kernels
+ *
+ * runtime loops of the shaped operations over a pointer to the first row, the extents
+ * and the row stride. They are instantiated once per scalar type instead of once per
+ * shape and keep the summation order of the shaped loops for any tiling, so all of them
+ * give the same results. Constant evaluation cannot walk the rows of a mat through one
+ * pointer and keeps the shaped loops
+ */
+namespace mlp::detail
+{
+// product types of A and B the kernels are used for
+template<typename A, typename B>
+inline constexpr auto erasable = std::is_same_v<A, B> && std::is_same_v<decltype(A{} * B{}), A>;
+
+namespace kernel
+{
+// calls f(begin, end) for ranges of the n rows, one per thread
+template<typename F>
+void split(std::size_t n, std::size_t threads, F&& f)
+{
+  struct range
+  {
+    const F& f;
+    std::size_t n;
+    std::size_t chunk;
+  };
+
+  const auto chunk = (n + threads - 1) / (threads == 0 ? 1 : threads);
+  const auto run = executor().load(std::memory_order_acquire);
+  if (threads < 2 || chunk == n || !run)
+  {
+    f(std::size_t{0}, n);
+    return;
+  }
+
+  const auto r = range{f, n, chunk};
+  run((n + chunk - 1) / chunk, [](const void* c, std::size_t i){
+    const auto& r = *static_cast<const range*>(c);
+    r.f(i * r.chunk, r.n - i * r.chunk < r.chunk ? r.n : (i + 1) * r.chunk);
+  }, &r);
+}
+
+// y = a * x with R rows at a time
+template<std::size_t R, typename T>
+void matvec(const T* a, std::size_t rows, std::size_t cols, std::size_t stride, const T* x, T* y)
+{
+  auto i = std::size_t{};
+  for (; i + R <= rows; i += R, a += R * stride)
+  {
+    auto y_r = vec<T, R>{};
+    for (std::size_t j = 0; j < cols; ++j)
+      for (std::size_t r = 0; r < R; ++r)
+        y_r[r] = y_r[r] + a[r * stride + j] * x[j];
+    for (std::size_t r = 0; r < R; ++r)
+      y[i + r] = y_r[r];
+  }
+  if constexpr (R > 1)
+    matvec<1>(a, rows - i, cols, stride, x, y + i);
+}
+
+template<typename T>
+void matvec(const T* a, std::size_t rows, std::size_t cols, std::size_t stride, const T* x, T* y)
+{
+  const auto t = tuned(rows, cols, 1);
+  split(rows, t.threads, [&](std::size_t begin, std::size_t end){
+    const auto* a_r = a + begin * stride;
+    switch (t.rows)
+    {
+    case 8:
+      return matvec<8>(a_r, end - begin, cols, stride, x, y + begin);
+    case 4:
+      return matvec<4>(a_r, end - begin, cols, stride, x, y + begin);
+    case 2:
+      return matvec<2>(a_r, end - begin, cols, stride, x, y + begin);
+    default:
+      return matvec<1>(a_r, end - begin, cols, stride, x, y + begin);
+    }
+  });
+}
+
+// c = a * b with the rows of c accumulated over the rows of b in tiles of columns,
+// c is zero on entry
+template<typename T>
+void matmul(const T* a, std::size_t rows, std::size_t inner, std::size_t cols, const T* b, T* c)
+{
+  const auto t = tuned(rows, inner, cols);
+  const auto w = t.cols == 0 || t.cols > cols ? cols : t.cols;
+  split(rows, t.threads, [&](std::size_t begin, std::size_t end){
+    for (std::size_t p_0 = 0; p_0 < cols; p_0 += w)
+    {
+      const auto p_1 = cols - p_0 < w ? cols : p_0 + w;
+      for (std::size_t i = begin; i < end; ++i)
+      {
+        const auto* a_i = a + i * inner;
+        auto* c_i = c + i * cols;
+        for (std::size_t j = 0; j < inner; ++j)
+        {
+          const auto a_ij = a_i[j];
+          const auto* b_j = b + j * cols;
+          for (std::size_t p = p_0; p < p_1; ++p)
+            c_i[p] = c_i[p] + a_ij * b_j[p];
+        }
+      }
+    }
+  });
+}
+
+// c = a * transpose(b), the dot products of the rows of a with the rows of b computed
+// in register tiles of rows of both, each of them summed in the order of mat * vec.
+// The rows of a are split over the threads tuned for the product of b with one of them
+template<typename T>
+void rowdots(const T* a, std::size_t rows, std::size_t cols, const T* b, std::size_t n, T* c)
+{
+  constexpr auto r = std::size_t{4};
+  const auto dot = [cols](const T* a_i, const T* b_o){
+    auto c_io = T{};
+    for (std::size_t j = 0; j < cols; ++j)
+      c_io = c_io + b_o[j] * a_i[j];
+    return c_io;
+  };
+
+  split(rows, tuned(n, cols, 1).threads, [&](std::size_t begin, std::size_t end){
+    auto i = begin;
+    for (; i + r <= end; i += r)
+    {
+      auto o = std::size_t{};
+      for (; o + r <= n; o += r)
+      {
+        auto c_r = mat<T, r, r>{};
+        for (std::size_t j = 0; j < cols; ++j)
+          for (std::size_t p = 0; p < r; ++p)
+            for (std::size_t q = 0; q < r; ++q)
+              c_r[p][q] = c_r[p][q] + b[(o + q) * cols + j] * a[(i + p) * cols + j];
+        for (std::size_t p = 0; p < r; ++p)
+          for (std::size_t q = 0; q < r; ++q)
+            c[(i + p) * n + o + q] = c_r[p][q];
+      }
+      for (; o < n; ++o)
+        for (std::size_t p = 0; p < r; ++p)
+          c[(i + p) * n + o] = dot(a + (i + p) * cols, b + o * cols);
+    }
+    for (; i < end; ++i)
+      for (std::size_t o = 0; o < n; ++o)
+        c[i * n + o] = dot(a + i * cols, b + o * cols);
+  });
+}
+
+// y = transpose(a) * x with the rows of a streamed once, y is zero on entry
+template<typename T>
+void tmatvec(const T* a, std::size_t rows, std::size_t cols, std::size_t stride, const T* x, T* y)
+{
+  for (std::size_t i = 0; i < rows; ++i, a += stride)
+  {
+    const auto x_i = x[i];
+    for (std::size_t j = 0; j < cols; ++j)
+      y[j] = y[j] + a[j] * x_i;
+  }
+}
+
+// c = transpose(a) * b over bands of the rows of c small enough to stay in cache while
+// the rows of a and b are streamed, c is zero on entry
+template<typename T>
+void tmatmul(const T* a, std::size_t rows, std::size_t cols, const T* b, std::size_t p, T* c)
+{
+  const auto band = std::max(std::size_t{1}, (std::size_t{1} << 15) / p);
+  for (std::size_t j_0 = 0; j_0 < cols; j_0 += band)
+  {
+    const auto j_1 = std::min(cols, j_0 + band);
+    for (std::size_t i = 0; i < rows; ++i)
+    {
+      const auto* a_i = a + i * cols;
+      const auto* b_i = b + i * p;
+      for (std::size_t j = j_0; j < j_1; ++j)
+      {
+        const auto a_ij = a_i[j];
+        auto* c_j = c + j * p;
+        for (std::size_t k = 0; k < p; ++k)
+          c_j[k] = c_j[k] + a_ij * b_i[k];
+      }
+    }
+  }
+}
+
+// recursion split points are multiples of the micro block so that blocks below the
+// leaf size are tiled by full micro blocks where possible
+inline constexpr auto micro = std::size_t{8};
+inline constexpr auto leaf = std::size_t{32};
+
+constexpr auto half(std::size_t n) -> std::size_t
+{
+  return (n / 2 + micro - 1) / micro * micro;
+}
+
+// b = transpose(a) of a micro block, the fixed extents let the compiler unroll it into
+// register moves
+template<typename T>
+void transpose_micro(const T* a, std::size_t s_a, T* b, std::size_t s_b)
+{
+  for (std::size_t j = 0; j < micro; ++j)
+    for (std::size_t i = 0; i < micro; ++i)
+      b[j * s_b + i] = a[i * s_a + j];
+}
+
+// b = transpose(a) for a rows x cols block, cache-oblivious: the longer side is halved
+// until the block fits in cache whatever its size is
+template<typename T>
+void transpose(const T* a, std::size_t rows, std::size_t cols, std::size_t s_a, T* b, std::size_t s_b)
+{
+  if (rows > leaf || cols > leaf)
+  {
+    if (rows >= cols)
+    {
+      const auto h = half(rows);
+      transpose(a, h, cols, s_a, b, s_b);
+      transpose(a + h * s_a, rows - h, cols, s_a, b + h, s_b);
+    }
+    else
+    {
+      const auto h = half(cols);
+      transpose(a, rows, h, s_a, b, s_b);
+      transpose(a + h, rows, cols - h, s_a, b + h * s_b, s_b);
+    }
+    return;
+  }
+
+  const auto r = rows / micro * micro;
+  const auto c = cols / micro * micro;
+  for (std::size_t i = 0; i < r; i += micro)
+    for (std::size_t j = 0; j < c; j += micro)
+      transpose_micro(a + i * s_a + j, s_a, b + j * s_b + i, s_b);
+  for (std::size_t i = 0; i < rows; ++i)
+    for (std::size_t j = i < r ? c : 0; j < cols; ++j)
+      b[j * s_b + i] = a[i * s_a + j];
+}
+
+// exchanges the rows x cols block x with the transpose of the cols x rows block y.
+// The swaps walk the rows of both blocks at once, so the recursion goes down to micro
+// blocks whose rows fit in the ways of a cache set even with power-of-two strides
+template<typename T>
+void swap_transposed(T* x, T* y, std::size_t rows, std::size_t cols, std::size_t s)
+{
+  if (rows > micro || cols > micro)
+  {
+    if (rows >= cols)
+    {
+      const auto h = half(rows);
+      swap_transposed(x, y, h, cols, s);
+      swap_transposed(x + h * s, y + h, rows - h, cols, s);
+    }
+    else
+    {
+      const auto h = half(cols);
+      swap_transposed(x, y, rows, h, s);
+      swap_transposed(x + h, y + h * s, rows, cols - h, s);
+    }
+    return;
+  }
+
+  for (std::size_t i = 0; i < rows; ++i)
+    for (std::size_t j = 0; j < cols; ++j)
+    {
+      const auto t = x[i * s + j];
+      x[i * s + j] = y[j * s + i];
+      y[j * s + i] = t;
+    }
+}
+
+// a = transpose(a) for an n x n block, the diagonal quadrants are transposed in place
+// and the off-diagonal ones are swapped transposed
+template<typename T>
+void transpose_inplace(T* a, std::size_t n, std::size_t s)
+{
+  if (n <= micro)
+  {
+    for (std::size_t i = 1; i < n; ++i)
+      for (std::size_t j = 0; j < i; ++j)
+      {
+        const auto t = a[i * s + j];
+        a[i * s + j] = a[j * s + i];
+        a[j * s + i] = t;
+      }
+    return;
+  }
+
+  const auto h = half(n);
+  transpose_inplace(a, h, s);
+  transpose_inplace(a + h * s + h, n - h, s);
+  swap_transposed(a + h, a + h * s, h, n - h, s);
+}
+} // namespace kernel
+
+// c = a * transpose(b) for the erasable types, by CBLAS from the crossover on
+template<typename T, std::size_t M, std::size_t N, std::size_t P>
+void rowdots(const mat<T, M, N>& a, const mat<T, P, N>& b, mat<T, M, P>& c)
+{
+  static_assert(sizeof(a) == sizeof(T) * M * N && sizeof(b) == sizeof(T) * P * N && sizeof(c) == sizeof(T) * M * P);
+  if constexpr (blas_types<T, T>)
+    if (use_blas(M * N * P))
+    {
+      gemm_nt(a, b, c);
+      return;
+    }
+  kernel::rowdots(a[0].data(), M, N, b[0].data(), P, c[0].data());
+}
+} // namespace mlp::detail
+
 /*
  * mat operations
  */
@@ -137,6 +833,20 @@ template<typename A, typename B, std::size_t M, std::size_t N, std::size_t P>
 constexpr auto operator*(const mat<A, M, N>& a, const mat<B, N, P>& b) -> mat<decltype(A{} * B{}), M, P>
 {
   auto c = mat<decltype(A{} * B{}), M, P>{};
+  if constexpr (detail::erasable<A, B> && M * N * P > 0)
+    if (!detail::constant_evaluated())
+    {
+      static_assert(sizeof(a) == sizeof(A) * M * N && sizeof(b) == sizeof(B) * N * P && sizeof(c) == sizeof(A) * M * P);
+      if constexpr (detail::blas_types<A, B>)
+        if (detail::use_blas(M * N * P))
+        {
+          detail::gemm(a, b, c);
+          return c;
+        }
+      detail::kernel::matmul(a[0].data(), M, N, P, b[0].data(), c[0].data());
+      return c;
+    }
+
   for (std::size_t i = 0; i < M; ++i)
     for (std::size_t p = 0; p < P; ++p)
       for (std::size_t j = 0; j < N; ++j)
@@ -149,6 +859,24 @@ constexpr auto operator*(const mat<A, M, N>& a, B b) -> mat<decltype(A{} * B{}),
 {
   return fmap([b](A a_m){ return a_m * b; }, a);
 }
+
+template<typename A, typename B, std::size_t M, std::size_t N>
+constexpr auto operator+=(mat<A, M, N>& a, const mat<B, M, N>& b) -> mat<A, M, N>&
+{
+  return zip_into([](A a_m, B b_m){ return a_m + b_m; }, a, b, a);
+}
+
+template<typename A, typename B, std::size_t M, std::size_t N>
+constexpr auto operator-=(mat<A, M, N>& a, const mat<B, M, N>& b) -> mat<A, M, N>&
+{
+  return zip_into([](A a_m, B b_m){ return a_m - b_m; }, a, b, a);
+}
+
+template<typename A, typename B, std::size_t M, std::size_t N>
+constexpr auto operator*=(mat<A, M, N>& a, B b) -> mat<A, M, N>&
+{
+  return fmap_inplace([b](A a_m){ return a_m * b; }, a);
+}
 } // namespace mlp
 
 /*
@@ -160,6 +888,20 @@ template<typename A, typename B, std::size_t M, std::size_t N>
 constexpr auto operator*(const mat<A, M, N>& a, const vec<B, N>& b) -> vec<decltype(A{} * B{}), M>
 {
   auto c = vec<decltype(A{} * B{}), M>{};
+  if constexpr (detail::erasable<A, B> && M * N > 0)
+    if (!detail::constant_evaluated())
+    {
+      static_assert(sizeof(a) == sizeof(A) * M * N);
+      if constexpr (detail::blas_types<A, B>)
+        if (detail::use_blas(M * N))
+        {
+          detail::gemv(a, b, c);
+          return c;
+        }
+      detail::kernel::matvec(a[0].data(), M, N, N, b.data(), c.data());
+      return c;
+    }
+
   for (std::size_t i = 0; i < M; ++i)
     for (std::size_t j = 0; j < N; ++j)
       c[i] = c[i] + a[i][j] * b[j];
@@ -216,9 +958,128 @@ template<typename T, std::size_t M, std::size_t N>
 constexpr auto transpose(const mat<T, M, N>& a) -> mat<T, N, M>
 {
   auto a_t = mat<T, N, M>{};
+  if constexpr (M * N > 0)
+    if (!detail::constant_evaluated())
+    {
+      static_assert(sizeof(a) == sizeof(T) * M * N && sizeof(a_t) == sizeof(T) * N * M);
+      detail::kernel::transpose(a[0].data(), M, N, N, a_t[0].data(), M);
+      return a_t;
+    }
+
   for (std::size_t i = 0; i < M; ++i)
     for (std::size_t j = 0; j < N; ++j)
       a_t[j][i] = a[i][j];
   return a_t;
 }
+
+template<typename T, std::size_t N>
+constexpr auto transpose_inplace(mat<T, N, N>& a) -> mat<T, N, N>&
+{
+  if constexpr (N > 0)
+    if (!detail::constant_evaluated())
+    {
+      static_assert(sizeof(a) == sizeof(T) * N * N);
+      detail::kernel::transpose_inplace(a[0].data(), N, N);
+      return a;
+    }
+
+  for (std::size_t i = 1; i < N; ++i)
+    for (std::size_t j = 0; j < i; ++j)
+    {
+      const auto t = a[i][j];
+      a[i][j] = a[j][i];
+      a[j][i] = t;
+    }
+  return a;
+}
+
+// transpose(a) * x without materializing the transpose
+template<typename A, typename B, std::size_t M, std::size_t N>
+constexpr auto tmul(const mat<A, M, N>& a, const vec<B, M>& x) -> vec<decltype(A{} * B{}), N>
+{
+  auto y = vec<decltype(A{} * B{}), N>{};
+  if constexpr (detail::erasable<A, B> && M * N > 0)
+    if (!detail::constant_evaluated())
+    {
+      static_assert(sizeof(a) == sizeof(A) * M * N);
+      detail::kernel::tmatvec(a[0].data(), M, N, N, x.data(), y.data());
+      return y;
+    }
+
+  for (std::size_t j = 0; j < N; ++j)
+    for (std::size_t i = 0; i < M; ++i)
+      y[j] = y[j] + a[i][j] * x[i];
+  return y;
+}
+
+// transpose(a) * b without materializing the transpose
+template<typename A, typename B, std::size_t M, std::size_t N, std::size_t P>
+constexpr auto tmul(const mat<A, M, N>& a, const mat<B, M, P>& b) -> mat<decltype(A{} * B{}), N, P>
+{
+  auto c = mat<decltype(A{} * B{}), N, P>{};
+  if constexpr (detail::erasable<A, B> && M * N * P > 0)
+    if (!detail::constant_evaluated())
+    {
+      static_assert(sizeof(a) == sizeof(A) * M * N && sizeof(b) == sizeof(B) * M * P && sizeof(c) == sizeof(A) * N * P);
+      detail::kernel::tmatmul(a[0].data(), M, N, b[0].data(), P, c[0].data());
+      return c;
+    }
+
+  for (std::size_t j = 0; j < N; ++j)
+    for (std::size_t p = 0; p < P; ++p)
+      for (std::size_t i = 0; i < M; ++i)
+        c[j][p] = c[j][p] + a[i][j] * b[i][p];
+  return c;
+}
+} // namespace mlp
+
+/*
+ * sparse definition
+ *
+ * spvec holds K index/value pairs of a vector of extent M, unused pairs are to be zero-valued.
+ * spmat holds M rows of extent N in compressed sparse row form with K pairs in total,
+ * pairs p[m] to p[m + 1] belong to the m-th row
+ */
+namespace mlp
+{
+template<typename T, std::size_t M, std::size_t K>
+struct spvec
+{
+  vec<std::size_t, K> i;
+  vec<T, K> v;
+};
+
+template<typename T, std::size_t M, std::size_t N, std::size_t K>
+struct spmat
+{
+  vec<std::size_t, M + 1> p;
+  vec<std::size_t, K> i;
+  vec<T, K> v;
+};
+} // namespace mlp
+
+/*
+ * sparse operations
+ */
+namespace mlp
+{
+namespace detail
+{
+// product of a and the vector given by n index/value pairs, gathering only their columns
+template<typename A, typename B, std::size_t M, std::size_t N>
+constexpr auto gather(const mat<A, M, N>& a, const std::size_t* is, const B* vs, std::size_t n) -> vec<decltype(A{} * B{}), M>
+{
+  auto c = vec<decltype(A{} * B{}), M>{};
+  for (std::size_t i = 0; i < M; ++i)
+    for (std::size_t k = 0; k < n; ++k)
+      c[i] = c[i] + a[i][is[k]] * vs[k];
+  return c;
+}
+} // namespace detail
+
+template<typename A, typename B, std::size_t M, std::size_t N, std::size_t K>
+constexpr auto operator*(const mat<A, M, N>& a, const spvec<B, N, K>& b) -> vec<decltype(A{} * B{}), M>
+{
+  return detail::gather(a, b.i.data(), b.v.data(), K);
+}
 } // namespace mlp
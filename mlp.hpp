@@ -9,20 +9,29 @@
 
 #include "neural.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
 #include <type_traits>
 #include <tuple>
+#include <utility>
+
+#if !defined(MLP_L2_CACHE_SIZE)
+#define MLP_L2_CACHE_SIZE 1048576
+#endif
 
 /*
  * layer definition
  */
 namespace mlp
 {
-template<std::size_t I, std::size_t O>
+template<std::size_t I, std::size_t O, typename T = double>
 struct layer
 {
   act a;
-  mat<double, O, I> w;
-  vec<double, O> b;
+  mat<T, O, I> w;
+  vec<T, O> b;
+  actmode m = actmode::Exact;
 };
 } // namespace mlp
 
@@ -31,16 +40,213 @@ struct layer
  */
 namespace mlp
 {
-template<std::size_t I, std::size_t O>
-constexpr auto operator>>(const vec<double, I>& x, const layer<I, O>& l) -> vec<double, O>
+namespace detail
+{
+template<typename T, std::size_t I, std::size_t O>
+constexpr auto affine(const layer<I, O, T>& l, const vec<T, I>& x) -> vec<T, O>
+{
+  auto z = l.w * x;
+  return z += l.b;
+}
+} // namespace detail
+
+template<typename T, std::size_t I, std::size_t O>
+constexpr auto operator>>(const vec<T, I>& x, const layer<I, O, T>& l) -> vec<T, O>
+{
+  return activation(l.a, l.m, detail::affine(l, x));
+}
+
+// at runtime the rows of a batch go through the weights as one product, computed by
+// CBLAS from the crossover on and otherwise in the summation order of a single row
+template<typename T, std::size_t I, std::size_t O, std::size_t N>
+constexpr auto operator>>(const mat<T, N, I>& x, const layer<I, O, T>& l) -> mat<T, N, O>
+{
+  if constexpr (detail::erasable<T, T> && N * I * O > 0)
+    if (!detail::constant_evaluated())
+    {
+      auto y = mat<T, N, O>{};
+      detail::rowdots(x, l.w, y);
+      for (auto& y_n : y)
+        y_n = activation(l.a, l.m, y_n += l.b);
+      return y;
+    }
+
+  return fmap([&l](const vec<T, I>& x_i){ return x_i >> l; }, x);
+}
+} // namespace mlp
+
+/*
+ * binlayer definition
+ *
+ * layer with binarized weights and inputs packed into 64-bit words, so that a dot
+ * product of I elements is an XNOR and a popcount per 64 of them. A row of weights
+ * is binarized to its signs scaled by the mean of its absolute values. The real-valued
+ * shadow weights are kept for training with the straight-through estimator, a row of
+ * them has to be packed again after it is changed
+ */
+namespace mlp
+{
+namespace detail
+{
+inline constexpr auto bits = std::size_t{64};
+
+template<std::size_t I>
+using bitvec = vec<std::uint64_t, (I + bits - 1) / bits>;
+
+constexpr auto popcount(std::uint64_t x) -> std::size_t
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<std::size_t>(__builtin_popcountll(x));
+#else
+  x = x - ((x >> 1) & 0x5555555555555555);
+  x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0f;
+  return static_cast<std::size_t>((x * 0x0101010101010101) >> 56);
+#endif
+}
+
+// sets the bits of the non-negative elements
+template<typename T, std::size_t I>
+constexpr auto pack(const vec<T, I>& x) -> bitvec<I>
+{
+  auto p = bitvec<I>{};
+  for (std::size_t i = 0; i < I; ++i)
+    if (!(x[i] < T(0)))
+      p[i / bits] |= std::uint64_t{1} << (i % bits);
+  return p;
+}
+
+// dot product of the sign vectors, the padding bits are zero in both and do not count
+template<std::size_t I>
+constexpr auto xnor(const bitvec<I>& a, const bitvec<I>& b) -> std::int64_t
+{
+  auto d = std::size_t{};
+  for (std::size_t w = 0; w < a.size(); ++w)
+    d += popcount(a[w] ^ b[w]);
+  return static_cast<std::int64_t>(I) - 2 * static_cast<std::int64_t>(d);
+}
+} // namespace detail
+
+template<std::size_t I, std::size_t O, typename T = double>
+struct binlayer
+{
+  act a;
+  mat<T, O, I> w;
+  vec<T, O> b;
+  actmode m;
+  mat<std::uint64_t, O, (I + detail::bits - 1) / detail::bits> p;
+  vec<T, O> s;
+
+  constexpr binlayer(act a, const mat<T, O, I>& w, const vec<T, O>& b, actmode m = actmode::Exact)
+    : a{a}
+    , w{w}
+    , b{b}
+    , m{m}
+    , p{}
+    , s{}
+  {
+    for (std::size_t o = 0; o < O; ++o)
+      pack(o);
+  }
+
+  // binarizes the o-th row of the shadow weights
+  constexpr void pack(std::size_t o)
+  {
+    p[o] = detail::pack(w[o]);
+    s[o] = reduce(std::plus{}, T(0), fmap([](T w_i){ return w_i < T(0) ? -w_i : w_i; }, w[o])) / T(I);
+  }
+};
+} // namespace mlp
+
+/*
+ * binlayer operations
+ *
+ * inputs are binarized by their signs so the preceding activation is expected to be
+ * symmetric around zero like Tanh or Linear
+ */
+namespace mlp
+{
+namespace detail
 {
-  return activation(l.a, l.w * x + l.b);
+template<typename T, std::size_t I, std::size_t O>
+constexpr auto affine(const binlayer<I, O, T>& l, const vec<T, I>& x) -> vec<T, O>
+{
+  const auto x_b = pack(x);
+  auto z = vec<T, O>{};
+  for (std::size_t o = 0; o < O; ++o)
+    z[o] = l.s[o] * T(xnor<I>(l.p[o], x_b)) + l.b[o];
+  return z;
 }
+} // namespace detail
 
-template<std::size_t I, std::size_t O, std::size_t N>
-constexpr auto operator>>(const mat<double, N, I>& x, const layer<I, O>& l) -> mat<double, N, O>
+template<typename T, std::size_t I, std::size_t O>
+constexpr auto operator>>(const vec<T, I>& x, const binlayer<I, O, T>& l) -> vec<T, O>
 {
-    return fmap([&l](const vec<double, I>& x_i){ return x_i >> l; }, x);
+  return activation(l.a, l.m, detail::affine(l, x));
+}
+
+template<typename T, std::size_t I, std::size_t O, std::size_t N>
+constexpr auto operator>>(const mat<T, N, I>& x, const binlayer<I, O, T>& l) -> mat<T, N, O>
+{
+  return fmap([&l](const vec<T, I>& x_i){ return x_i >> l; }, x);
+}
+} // namespace mlp
+
+/*
+ * embedding definition
+ *
+ * table of V rows of D elements looked up by the K ids of a multi-valued field,
+ * the rows are pooled into a single vector by their sum or mean
+ */
+namespace mlp
+{
+enum class pooling : int
+{
+  Sum,
+  Mean
+};
+
+template<std::size_t V, std::size_t D, typename T = double>
+struct embedding
+{
+  pooling p;
+  mat<T, V, D> w;
+};
+} // namespace mlp
+
+/*
+ * embedding operations
+ *
+ * ids past the end of the table throw, which also fails constant evaluation
+ */
+namespace mlp
+{
+namespace detail
+{
+template<std::size_t V>
+constexpr auto lookup(std::size_t id) -> std::size_t
+{
+  if (id >= V)
+    throw std::out_of_range("embedding id");
+  return id;
+}
+} // namespace detail
+
+template<std::size_t K, std::size_t V, std::size_t D, typename T>
+constexpr auto operator>>(const vec<std::size_t, K>& ids, const embedding<V, D, T>& e) -> vec<T, D>
+{
+  auto y = vec<T, D>{};
+  for (std::size_t k = 0; k < K; ++k)
+    y += e.w[detail::lookup<V>(ids[k])];
+  if (e.p == pooling::Mean && K > 0)
+    y *= T(1) / T(K);
+  return y;
+}
+
+template<std::size_t K, std::size_t V, std::size_t D, typename T, std::size_t N>
+constexpr auto operator>>(const mat<std::size_t, N, K>& ids, const embedding<V, D, T>& e) -> mat<T, N, D>
+{
+  return fmap([&e](const vec<std::size_t, K>& ids_n){ return ids_n >> e; }, ids);
 }
 } // namespace mlp
 
@@ -58,36 +264,406 @@ using mlp = std::tuple<Ls...>;
  */
 namespace mlp
 {
-template<std::size_t I, std::size_t N, std::size_t O>
-constexpr auto operator+(const layer<I, N>& li, const layer<N, O>& lo) -> mlp<layer<I, N>, layer<N, O>>
+template<std::size_t I, std::size_t N, std::size_t O, typename T>
+constexpr auto operator+(const layer<I, N, T>& li, const layer<N, O, T>& lo) -> mlp<layer<I, N, T>, layer<N, O, T>>
+{
+  return {li, lo};
+}
+
+template<std::size_t V, std::size_t D, std::size_t O, typename T>
+constexpr auto operator+(const embedding<V, D, T>& e, const layer<D, O, T>& l) -> mlp<embedding<V, D, T>, layer<D, O, T>>
+{
+  return {e, l};
+}
+
+template<std::size_t I, std::size_t N, std::size_t O, typename T>
+constexpr auto operator+(const binlayer<I, N, T>& li, const binlayer<N, O, T>& lo) -> mlp<binlayer<I, N, T>, binlayer<N, O, T>>
+{
+  return {li, lo};
+}
+
+template<std::size_t I, std::size_t N, std::size_t O, typename T>
+constexpr auto operator+(const layer<I, N, T>& li, const binlayer<N, O, T>& lo) -> mlp<layer<I, N, T>, binlayer<N, O, T>>
 {
   return {li, lo};
 }
 
-template<typename... Ls, std::size_t I, std::size_t N>
-constexpr auto operator+(const mlp<Ls...>& net, const layer<I, N>& l) -> mlp<Ls..., layer<I, N>>
+template<std::size_t I, std::size_t N, std::size_t O, typename T>
+constexpr auto operator+(const binlayer<I, N, T>& li, const layer<N, O, T>& lo) -> mlp<binlayer<I, N, T>, layer<N, O, T>>
+{
+  return {li, lo};
+}
+
+template<typename... Ls, std::size_t I, std::size_t N, typename T>
+constexpr auto operator+(const mlp<Ls...>& net, const layer<I, N, T>& l) -> mlp<Ls..., layer<I, N, T>>
+{
+  static_assert(sizeof(decltype(std::get<sizeof...(Ls) - 1>(net) + l)));
+  return std::tuple_cat(net, std::make_tuple(l));
+}
+
+template<typename... Ls, std::size_t I, std::size_t N, typename T>
+constexpr auto operator+(const mlp<Ls...>& net, const binlayer<I, N, T>& l) -> mlp<Ls..., binlayer<I, N, T>>
 {
   static_assert(sizeof(decltype(std::get<sizeof...(Ls) - 1>(net) + l)));
   return std::tuple_cat(net, std::make_tuple(l));
 }
+
+template<std::size_t I, std::size_t N, typename T, typename... Ls>
+constexpr auto operator+(const layer<I, N, T>& l, const mlp<Ls...>& net) -> mlp<layer<I, N, T>, Ls...>
+{
+  static_assert(sizeof(decltype(l + std::get<0>(net))));
+  return std::tuple_cat(std::make_tuple(l), net);
+}
+
+template<typename... Ls, typename... Rs>
+constexpr auto operator+(const mlp<Ls...>& a, const mlp<Rs...>& b) -> mlp<Ls..., Rs...>
+{
+  static_assert(sizeof(decltype(std::get<sizeof...(Ls) - 1>(a) + std::get<0>(b))));
+  return std::tuple_cat(a, b);
+}
 } // namespace mlp
 
 /*
  * mlp data forwarding operations
+ *
+ * at runtime a batch is forwarded in chunks of rows which are passed through all of the
+ * layers before the next chunk, instead of passing the whole batch through one layer
+ * at a time. The chunk size is computed at compile time so that the activations of a
+ * chunk in every layer take at most half of MLP_L2_CACHE_SIZE and stay in the cache
+ * between the layers, the other half is left to the weights. Rows are forwarded
+ * independently, so without CBLAS the results are the same either way
  */
 namespace mlp
 {
-template<std::size_t I, std::size_t O, typename... Ls>
-constexpr auto operator>>(const vec<double, I>& x, const mlp<layer<I, O>, Ls...>& net)
+namespace detail
+{
+inline constexpr auto l2 = std::size_t{MLP_L2_CACHE_SIZE};
+
+// bytes of the activations of a row at the input and at the output of every layer
+template<typename X, typename L, typename... Ls>
+constexpr auto row_bytes() -> std::size_t
+{
+  using Y = decltype(std::declval<const X&>() >> std::declval<const L&>());
+  if constexpr (sizeof...(Ls) == 0)
+    return sizeof(X) + sizeof(Y);
+  else
+    return sizeof(X) + row_bytes<Y, Ls...>();
+}
+
+template<typename X, typename... Ls>
+inline constexpr auto chunk = std::max(std::size_t{1}, l2 / 2 / row_bytes<X, Ls...>());
+
+// forwards the C rows of x starting from the begin-th into the same rows of y
+template<std::size_t C, typename T, std::size_t N, std::size_t I, typename... Ls, typename Y>
+void forward_rows(const mat<T, N, I>& x, std::size_t begin, const mlp<Ls...>& net, Y& y)
+{
+  auto x_c = mat<T, C, I>{};
+  std::copy_n(x.begin() + begin, C, x_c.begin());
+  const auto y_c = std::apply([&x_c](const auto&... ls){ return (x_c >> ... >> ls); }, net);
+  std::copy_n(y_c.begin(), C, y.begin() + begin);
+}
+
+template<typename T, std::size_t N, std::size_t I, typename... Ls>
+auto forward_fused(const mat<T, N, I>& x, const mlp<Ls...>& net)
+{
+  constexpr auto c = chunk<vec<T, I>, Ls...>;
+
+  auto y = vec<decltype(std::declval<const vec<T, I>&>() >> net), N>{};
+  for (std::size_t n = 0; n + c <= N; n += c)
+    forward_rows<c>(x, n, net, y);
+  if constexpr (N % c != 0)
+    forward_rows<N % c>(x, N - N % c, net, y);
+  return y;
+}
+} // namespace detail
+
+template<typename T, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto operator>>(const vec<T, I>& x, const mlp<layer<I, O, T>, Ls...>& net)
 {
   return std::apply([&x](const auto&... ls){ return (x >> ... >> ls); }, net);
 }
 
-template<std::size_t I, std::size_t O, std::size_t N, typename... Ls>
-constexpr auto operator>>(const mat<double, N, I>& x, const mlp<layer<I, O>, Ls...>& net)
+template<typename T, std::size_t I, std::size_t O, std::size_t N, typename... Ls>
+constexpr auto operator>>(const mat<T, N, I>& x, const mlp<layer<I, O, T>, Ls...>& net)
 {
+  if constexpr (N > detail::chunk<vec<T, I>, layer<I, O, T>, Ls...>)
+    if (!detail::constant_evaluated())
+      return detail::forward_fused(x, net);
   return std::apply([&x](const auto&... ls){ return (x >> ... >> ls); }, net);
 }
+
+template<typename T, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto operator>>(const vec<T, I>& x, const mlp<binlayer<I, O, T>, Ls...>& net)
+{
+  return std::apply([&x](const auto&... ls){ return (x >> ... >> ls); }, net);
+}
+
+template<typename T, std::size_t I, std::size_t O, std::size_t N, typename... Ls>
+constexpr auto operator>>(const mat<T, N, I>& x, const mlp<binlayer<I, O, T>, Ls...>& net)
+{
+  if constexpr (N > detail::chunk<vec<T, I>, binlayer<I, O, T>, Ls...>)
+    if (!detail::constant_evaluated())
+      return detail::forward_fused(x, net);
+  return std::apply([&x](const auto&... ls){ return (x >> ... >> ls); }, net);
+}
+
+template<std::size_t K, std::size_t V, std::size_t D, typename T, typename... Ls>
+constexpr auto operator>>(const vec<std::size_t, K>& ids, const mlp<embedding<V, D, T>, Ls...>& net)
+{
+  return std::apply([&ids](const auto&... ls){ return (ids >> ... >> ls); }, net);
+}
+
+template<std::size_t K, std::size_t V, std::size_t D, typename T, std::size_t N, typename... Ls>
+constexpr auto operator>>(const mat<std::size_t, N, K>& ids, const mlp<embedding<V, D, T>, Ls...>& net)
+{
+  return std::apply([&ids](const auto&... ls){ return (ids >> ... >> ls); }, net);
+}
+} // namespace mlp
+
+/*
+ * network input and output types
+ */
+namespace mlp
+{
+template<typename L>
+struct input_of;
+
+template<std::size_t I, std::size_t O, typename T>
+struct input_of<layer<I, O, T>>
+{
+  using type = vec<T, I>;
+};
+
+template<std::size_t I, std::size_t O, typename T>
+struct input_of<binlayer<I, O, T>>
+{
+  using type = vec<T, I>;
+};
+
+template<typename Net>
+using input_t = typename input_of<std::tuple_element_t<0, Net>>::type;
+
+template<typename Net>
+using output_t = decltype(std::declval<const input_t<Net>&>() >> std::declval<const Net&>());
+} // namespace mlp
+
+/*
+ * mlp partial evaluation
+ *
+ * the first layer input is split into a shared segment of S leading elements and a
+ * per-candidate segment of the remaining ones. The shared part of the first layer
+ * product is computed once and the per-candidate part is added for every candidate,
+ * so results may differ from the full forward pass by rounding only.
+ * The network must outlive the partially evaluated one
+ */
+namespace mlp
+{
+namespace detail
+{
+// forwards x through the layers starting from the L-th
+template<std::size_t L, typename X, typename... Ls>
+constexpr auto forward(const X& x, const mlp<Ls...>& net)
+{
+  if constexpr (L == sizeof...(Ls))
+    return x;
+  else
+    return forward<L + 1>(x >> std::get<L>(net), net);
+}
+} // namespace detail
+
+template<std::size_t S, typename T, std::size_t I, std::size_t O, typename... Ls>
+struct shared
+{
+  static_assert(S <= I);
+
+  const mlp<layer<I, O, T>, Ls...>& net;
+  vec<T, O> z;
+};
+
+template<typename T, std::size_t S, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto share(const mlp<layer<I, O, T>, Ls...>& net, const vec<T, S>& x) -> shared<S, T, I, O, Ls...>
+{
+  const auto& l = std::get<0>(net);
+  auto z = l.b;
+  for (std::size_t o = 0; o < O; ++o)
+    for (std::size_t j = 0; j < S; ++j)
+      z[o] = z[o] + l.w[o][j] * x[j];
+  return {net, z};
+}
+
+template<std::size_t S, typename T, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto operator>>(const vec<T, I - S>& x, const shared<S, T, I, O, Ls...>& p)
+{
+  const auto& l = std::get<0>(p.net);
+  auto z = p.z;
+  for (std::size_t o = 0; o < O; ++o)
+    for (std::size_t j = 0; j < I - S; ++j)
+      z[o] = z[o] + l.w[o][S + j] * x[j];
+  return detail::forward<1>(activation(l.a, l.m, z), p.net);
+}
+
+template<std::size_t S, typename T, std::size_t I, std::size_t O, std::size_t N, typename... Ls>
+constexpr auto operator>>(const mat<T, N, I - S>& x, const shared<S, T, I, O, Ls...>& p)
+{
+  return fmap([&p](const vec<T, I - S>& x_n){ return x_n >> p; }, x);
+}
+} // namespace mlp
+
+/*
+ * mlp incremental evaluation
+ *
+ * keeps the input and the first layer pre-activation so that a change of k input
+ * elements costs k columns of the first layer plus the remaining layers.
+ * Rounding errors accumulate over updates and are discarded by refresh.
+ * The network must outlive the incremental evaluation
+ */
+namespace mlp
+{
+template<typename T, std::size_t I, std::size_t O, typename... Ls>
+struct incremental
+{
+  const mlp<layer<I, O, T>, Ls...>& net;
+  vec<T, I> x;
+  vec<T, O> z;
+
+  constexpr auto update(std::size_t i, T x_i) -> incremental&
+  {
+    const auto& l = std::get<0>(net);
+    const auto d = x_i - x[i];
+    for (std::size_t o = 0; o < O; ++o)
+      z[o] = z[o] + l.w[o][i] * d;
+    x[i] = x_i;
+    return *this;
+  }
+
+  template<std::size_t K>
+  constexpr auto update(const vec<std::size_t, K>& is, const vec<T, K>& xs) -> incremental&
+  {
+    for (std::size_t k = 0; k < K; ++k)
+      update(is[k], xs[k]);
+    return *this;
+  }
+
+  constexpr auto refresh() -> incremental&
+  {
+    const auto& l = std::get<0>(net);
+    z = l.w * x;
+    z += l.b;
+    return *this;
+  }
+
+  constexpr auto output() const
+  {
+    const auto& l = std::get<0>(net);
+    return detail::forward<1>(activation(l.a, l.m, z), net);
+  }
+};
+
+template<typename T, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto track(const mlp<layer<I, O, T>, Ls...>& net, const vec<T, I>& x) -> incremental<T, I, O, Ls...>
+{
+  auto inc = incremental<T, I, O, Ls...>{net, x, {}};
+  inc.refresh();
+  return inc;
+}
+} // namespace mlp
+
+/*
+ * mlp sparse data forwarding operations
+ */
+namespace mlp
+{
+template<typename T, std::size_t I, std::size_t O, std::size_t K>
+constexpr auto operator>>(const spvec<T, I, K>& x, const layer<I, O, T>& l) -> vec<T, O>
+{
+  auto z = l.w * x;
+  return activation(l.a, l.m, z += l.b);
+}
+
+template<typename T, std::size_t I, std::size_t O, std::size_t K, typename... Ls>
+constexpr auto operator>>(const spvec<T, I, K>& x, const mlp<layer<I, O, T>, Ls...>& net)
+{
+  return detail::forward<1>(x >> std::get<0>(net), net);
+}
+
+template<typename T, std::size_t N, std::size_t I, std::size_t K, std::size_t O, typename... Ls>
+constexpr auto operator>>(const spmat<T, N, I, K>& x, const mlp<layer<I, O, T>, Ls...>& net)
+{
+  const auto& l = std::get<0>(net);
+  auto y = vec<decltype(vec<T, I>{} >> net), N>{};
+  for (std::size_t n = 0; n < N; ++n)
+  {
+    auto z = detail::gather(l.w, x.i.data() + x.p[n], x.v.data() + x.p[n], x.p[n + 1] - x.p[n]);
+    y[n] = detail::forward<1>(activation(l.a, l.m, z += l.b), net);
+  }
+  return y;
+}
+} // namespace mlp
+
+/*
+ * mlp parameters
+ *
+ * weights and biases of all the layers of a network as a single vec, each layer
+ * contributes its weights row by row followed by its biases
+ */
+namespace mlp
+{
+namespace detail
+{
+template<typename L>
+struct parameters;
+
+template<std::size_t I, std::size_t O, typename T>
+struct parameters<layer<I, O, T>>
+{
+  static constexpr auto inputs = I;
+  static constexpr auto outputs = O;
+  static constexpr auto size = O * I + O;
+
+  template<typename P>
+  static constexpr void get(const layer<I, O, T>& l, P& p, std::size_t& k)
+  {
+    for (const auto& w : l.w)
+      for (const auto w_i : w)
+        p[k++] = w_i;
+    for (const auto b_o : l.b)
+      p[k++] = b_o;
+  }
+
+  template<typename P>
+  static constexpr void set(layer<I, O, T>& l, const P& p, std::size_t& k)
+  {
+    for (auto& w : l.w)
+      for (auto& w_i : w)
+        w_i = p[k++];
+    for (auto& b_o : l.b)
+      b_o = p[k++];
+  }
+};
+} // namespace detail
+
+template<typename... Ls>
+inline constexpr auto parameters_v = (detail::parameters<Ls>::size + ... + 0);
+
+template<typename Net>
+using scalar_t = typename std::decay_t<decltype(std::declval<std::tuple_element_t<0, Net>>().b)>::value_type;
+
+template<typename... Ls>
+constexpr auto flatten(const mlp<Ls...>& net) -> vec<scalar_t<mlp<Ls...>>, parameters_v<Ls...>>
+{
+  auto p = vec<scalar_t<mlp<Ls...>>, parameters_v<Ls...>>{};
+  auto k = std::size_t{};
+  std::apply([&p, &k](const auto&... ls){ (detail::parameters<std::decay_t<decltype(ls)>>::get(ls, p, k), ...); }, net);
+  return p;
+}
+
+template<typename... Ls>
+constexpr auto unflatten(const vec<scalar_t<mlp<Ls...>>, parameters_v<Ls...>>& p, mlp<Ls...>& net) -> mlp<Ls...>&
+{
+  auto k = std::size_t{};
+  std::apply([&p, &k](auto&... ls){ (detail::parameters<std::decay_t<decltype(ls)>>::set(ls, p, k), ...); }, net);
+  return net;
+}
 } // namespace mlp
 
 /*
@@ -100,34 +676,169 @@ struct fitparms
   std::size_t epochs;
   double rate;
   lossf loss;
+
+  // epochs between checkpoints of the runtime fit, 0 disables them
+  std::size_t interval = 0;
+
+  // epochs without improvement of the validation loss before the runtime fit stops, 0 disables it
+  std::size_t patience = 0;
 };
 
-template<std::size_t L = 0, std::size_t I, std::size_t O, typename... Ls>
-constexpr auto backpropagate(mlp<Ls...>& net, const fitparms& par, const vec<double, I>& x, const vec<double, O>& y)
+namespace detail
+{
+// indices of the nonzero elements of a vec
+template<std::size_t M>
+struct support
+{
+  vec<std::size_t, M> i;
+  std::size_t n;
+
+  // loops over the indices only pay off when at most a half of the elements is nonzero
+  constexpr auto dense() const -> bool
+  {
+    return 2 * n > M;
+  }
+
+  constexpr auto operator[](std::size_t k) const -> std::size_t
+  {
+    return dense() ? k : i[k];
+  }
+
+  constexpr auto size() const -> std::size_t
+  {
+    return dense() ? M : n;
+  }
+};
+
+// the indices are only gathered when they are going to be used
+template<typename T, std::size_t M>
+constexpr auto nonzeros(const vec<T, M>& x) -> support<M>
+{
+  auto s = support<M>{};
+  for (std::size_t i = 0; i < M; ++i)
+    s.n += x[i] != T(0) ? 1 : 0;
+  if (s.dense())
+    return s;
+
+  s.n = 0;
+  for (std::size_t i = 0; i < M; ++i)
+    if (x[i] != T(0))
+      s.i[s.n++] = i;
+  return s;
+}
+
+// updates a layer by the delta of its pre-activation for the input x and returns the
+// gradient with respect to x if G is set. Rows of zero delta and columns of zero input are skipped
+template<bool G, typename T, std::size_t I, std::size_t O>
+constexpr auto descend(layer<I, O, T>& l, const fitparms& par, const vec<T, I>& x, const vec<T, O>& delta) -> vec<T, I>
+{
+  const auto rows = nonzeros(delta);
+
+  auto g = vec<T, I>{};
+  if constexpr (G)
+    for (std::size_t k = 0; k < rows.size(); ++k)
+      zip_into([d = delta[rows[k]]](T g_i, T w){ return g_i + w * d; }, g, l.w[rows[k]], g);
+
+  if (rows.size() > 0)
+  {
+    const auto cols = nonzeros(x);
+    for (std::size_t k = 0; k < rows.size(); ++k)
+    {
+      auto& w = l.w[rows[k]];
+      const auto d = delta[rows[k]];
+      if (cols.dense())
+        zip_into([d, r = par.rate](T w_i, T x_i){ return w_i - d * x_i * r; }, w, x, w);
+      else
+        for (std::size_t c = 0; c < cols.size(); ++c)
+          w[cols[c]] = w[cols[c]] - d * x[cols[c]] * par.rate;
+    }
+  }
+  l.b -= delta * par.rate;
+
+  return g;
+}
+
+// straight-through estimator: the binarization of the weights and of the inputs is taken
+// as identity within [-1, 1] and the shadow weights are clipped to that range
+template<bool G, typename T, std::size_t I, std::size_t O>
+constexpr auto descend(binlayer<I, O, T>& l, const fitparms& par, const vec<T, I>& x, const vec<T, O>& delta) -> vec<T, I>
+{
+  const auto rows = nonzeros(delta);
+  const auto sign = [](T v){ return v < T(0) ? T(-1) : T(1); };
+
+  auto g = vec<T, I>{};
+  if constexpr (G)
+  {
+    for (std::size_t k = 0; k < rows.size(); ++k)
+      zip_into([&sign, d = delta[rows[k]] * l.s[rows[k]]](T g_i, T w){ return g_i + sign(w) * d; }, g, l.w[rows[k]], g);
+    zip_into([](T g_i, T x_i){ return T(-1) <= x_i && x_i <= T(1) ? g_i : T(0); }, g, x, g);
+  }
+
+  for (std::size_t k = 0; k < rows.size(); ++k)
+  {
+    auto& w = l.w[rows[k]];
+    const auto d = delta[rows[k]] * l.s[rows[k]];
+    zip_into([&sign, d, r = par.rate](T w_i, T x_i){ return std::clamp(w_i - d * sign(x_i) * r, T(-1), T(1)); }, w, x, w);
+    l.pack(rows[k]);
+  }
+  l.b -= delta * par.rate;
+
+  return g;
+}
+} // namespace detail
+
+// updates the L-th and the following layers and returns the loss gradient with respect to
+// the L-th layer input for L > 0
+template<std::size_t L = 0, typename T, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto backpropagate(mlp<Ls...>& net, const fitparms& par, const vec<T, I>& x, const vec<T, O>& y)
 {
   static_assert(L < sizeof...(Ls));
 
   auto& l = std::get<L>(net);
-  const auto z = l.w * x + l.b;
-  const auto a = activation(l.a, z);
+  const auto z = detail::affine(l, x);
+  const auto a = activation(l.a, l.m, z);
 
-  auto delta = derivative(l.a, z);
+  auto delta = derivative(l.a, l.m, z);
   if constexpr (L == sizeof...(Ls) - 1)
-    delta = zip(std::multiplies{}, delta, derivative(par.loss, y, a));
+    zip_into(std::multiplies{}, delta, derivative(par.loss, y, a), delta);
   else
-  {
-    const auto w_next = transpose(std::get<L + 1>(net).w);
-    delta = zip(std::multiplies{}, delta, w_next * backpropagate<L + 1>(net, par, a, y));
-  }
+    zip_into(std::multiplies{}, delta, backpropagate<L + 1>(net, par, a, y), delta);
 
-  l.w = l.w - delta * transpose(x) * par.rate;
-  l.b = l.b - delta * par.rate;
+  if constexpr (L > 0)
+    return detail::descend<true>(l, par, x, delta);
+  else
+    detail::descend<false>(l, par, x, delta);
+}
 
-  return delta;
+// accumulates the loss gradient of a sample with respect to the weights and the biases of
+// the L-th and the following layers into g and returns the gradient with respect to the
+// L-th layer input for L > 0
+template<std::size_t L = 0, typename T, std::size_t I, std::size_t O, typename... Ls>
+constexpr auto gradient(const mlp<Ls...>& net, mlp<Ls...>& g, lossf f, const vec<T, I>& x, const vec<T, O>& y)
+{
+  static_assert(L < sizeof...(Ls));
+
+  const auto& l = std::get<L>(net);
+  const auto z = detail::affine(l, x);
+  const auto a = activation(l.a, l.m, z);
+
+  auto delta = derivative(l.a, l.m, z);
+  if constexpr (L == sizeof...(Ls) - 1)
+    zip_into(std::multiplies{}, delta, derivative(f, y, a), delta);
+  else
+    zip_into(std::multiplies{}, delta, gradient<L + 1>(net, g, f, a, y), delta);
+
+  auto& g_l = std::get<L>(g);
+  for (std::size_t o = 0; o < delta.size(); ++o)
+    zip_into([d = delta[o]](T g_i, T x_i){ return g_i + d * x_i; }, g_l.w[o], x, g_l.w[o]);
+  g_l.b += delta;
+
+  if constexpr (L > 0)
+    return tmul(l.w, delta);
 }
 
-template<std::size_t N, std::size_t I, std::size_t O, typename... Ls>
-constexpr auto fit(const mlp<Ls...>& net, const fitparms& par, const mat<double, N, I>& x, const mat<double, N, O>& y) -> mlp<Ls...>
+template<typename X, typename T, std::size_t N, std::size_t O, typename... Ls>
+constexpr auto fit(const mlp<Ls...>& net, const fitparms& par, const vec<X, N>& x, const mat<T, N, O>& y) -> mlp<Ls...>
 {
   auto fnet = net;
   for (std::size_t epoch = 1; epoch <= par.epochs; ++epoch)
@@ -136,3 +847,111 @@ constexpr auto fit(const mlp<Ls...>& net, const fitparms& par, const mat<double,
   return fnet;
 }
 } // namespace mlp
+
+/*
+ * mlp sparse training
+ *
+ * the first layer takes sparse input and only the columns of its active elements are updated
+ */
+namespace mlp
+{
+namespace detail
+{
+template<typename T, std::size_t I, std::size_t H, std::size_t O, typename... Ls>
+constexpr auto sparse_backpropagate(mlp<layer<I, H, T>, Ls...>& net, const fitparms& par, const std::size_t* is, const T* xs, std::size_t n, const vec<T, O>& y)
+{
+  auto& l = std::get<0>(net);
+  auto z = gather(l.w, is, xs, n);
+  z += l.b;
+  const auto a = activation(l.a, l.m, z);
+
+  auto delta = derivative(l.a, l.m, z);
+  if constexpr (sizeof...(Ls) == 0)
+    zip_into(std::multiplies{}, delta, derivative(par.loss, y, a), delta);
+  else
+    zip_into(std::multiplies{}, delta, backpropagate<1>(net, par, a, y), delta);
+
+  for (std::size_t k = 0; k < n; ++k)
+    for (std::size_t h = 0; h < H; ++h)
+      l.w[h][is[k]] = l.w[h][is[k]] - delta[h] * xs[k] * par.rate;
+  l.b -= delta * par.rate;
+}
+} // namespace detail
+
+template<typename T, std::size_t I, std::size_t H, std::size_t K, std::size_t O, typename... Ls>
+constexpr auto backpropagate(mlp<layer<I, H, T>, Ls...>& net, const fitparms& par, const spvec<T, I, K>& x, const vec<T, O>& y)
+{
+  detail::sparse_backpropagate(net, par, x.i.data(), x.v.data(), K, y);
+}
+
+template<typename T, std::size_t N, std::size_t I, std::size_t K, std::size_t O, typename... Ls>
+constexpr auto fit(const mlp<Ls...>& net, const fitparms& par, const spmat<T, N, I, K>& x, const mat<T, N, O>& y) -> mlp<Ls...>
+{
+  auto fnet = net;
+  for (std::size_t epoch = 1; epoch <= par.epochs; ++epoch)
+    for (std::size_t n = 0; n < N; ++n)
+      detail::sparse_backpropagate(fnet, par, x.i.data() + x.p[n], x.v.data() + x.p[n], x.p[n + 1] - x.p[n], y[n]);
+  return fnet;
+}
+} // namespace mlp
+
+/*
+ * mlp embedding training
+ *
+ * only the rows looked up by the ids of a sample are updated
+ */
+namespace mlp
+{
+template<std::size_t K, std::size_t V, std::size_t D, typename T, std::size_t O, typename... Ls>
+constexpr auto backpropagate(mlp<embedding<V, D, T>, Ls...>& net, const fitparms& par, const vec<std::size_t, K>& ids, const vec<T, O>& y)
+{
+  static_assert(sizeof...(Ls) > 0);
+
+  auto& e = std::get<0>(net);
+  auto delta = backpropagate<1>(net, par, ids >> e, y);
+  if (e.p == pooling::Mean && K > 0)
+    delta *= T(1) / T(K);
+
+  for (std::size_t k = 0; k < K; ++k)
+  {
+    auto& w = e.w[detail::lookup<V>(ids[k])];
+    zip_into([r = par.rate](T w_i, T d){ return w_i - d * r; }, w, delta, w);
+  }
+}
+} // namespace mlp
+
+/*
+ * mlp online training
+ *
+ * every update costs exactly one backpropagation per sample and never allocates,
+ * fitparms::epochs is not used
+ */
+namespace mlp
+{
+template<typename... Ls>
+struct learner
+{
+  mlp<Ls...> net;
+  fitparms par;
+  std::size_t steps = 0;
+
+  template<typename X, typename T, std::size_t O>
+  constexpr auto update(const X& x, const vec<T, O>& y) -> learner&
+  {
+    backpropagate(net, par, x, y);
+    ++steps;
+    return *this;
+  }
+
+  template<typename X, typename T, std::size_t N, std::size_t O>
+  constexpr auto update_batch(const vec<X, N>& x, const mat<T, N, O>& y) -> learner&
+  {
+    for (std::size_t n = 0; n < N; ++n)
+      update(x[n], y[n]);
+    return *this;
+  }
+};
+
+template<typename... Ls>
+learner(mlp<Ls...>, fitparms) -> learner<Ls...>;
+} // namespace mlp
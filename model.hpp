@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "mlp.hpp"
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+/*
+ * model definition
+ *
+ * read-copy-update handle over a network. Readers acquire the current version
+ * wait-free by incrementing a counter of the current epoch parity in one of S slots,
+ * the writer publishes a new version atomically and reclaims the old one once the
+ * counters of both parities it may have been read under have drained.
+ * The reclaimed version is kept as the buffer of the next one, so the writer
+ * alternates between two copies without allocating.
+ * A thread must release its snapshots before it publishes
+ */
+namespace mlp
+{
+namespace detail
+{
+inline auto thread_index() -> std::size_t
+{
+  static auto next = std::atomic<std::size_t>{};
+  thread_local const auto i = next.fetch_add(1, std::memory_order_relaxed);
+  return i;
+}
+} // namespace detail
+
+template<typename Net, std::size_t S = 64>
+class model
+{
+  static_assert(S > 0);
+
+  struct alignas(64) slot
+  {
+    std::array<std::atomic<std::size_t>, 2> readers{};
+  };
+
+  struct node
+  {
+    Net net;
+    std::size_t version;
+  };
+
+public:
+  class snapshot
+  {
+  public:
+    snapshot(snapshot&& s) noexcept
+      : n{s.n}
+      , readers{s.readers}
+    {
+      s.readers = nullptr;
+    }
+
+    snapshot(const snapshot&) = delete;
+    auto operator=(const snapshot&) -> snapshot& = delete;
+    auto operator=(snapshot&&) -> snapshot& = delete;
+
+    ~snapshot()
+    {
+      if (readers)
+        readers->fetch_sub(1);
+    }
+
+    auto operator*() const -> const Net& { return n->net; }
+    auto operator->() const -> const Net* { return &n->net; }
+
+    // number of publications before this version
+    auto version() const -> std::size_t { return n->version; }
+
+  private:
+    friend class model;
+
+    snapshot(const node* v, std::atomic<std::size_t>* r)
+      : n{v}
+      , readers{r}
+    {}
+
+    const node* n;
+    std::atomic<std::size_t>* readers;
+  };
+
+  explicit model(const Net& net)
+    : current{new node{net, 0}}
+  {}
+
+  model(const model&) = delete;
+  auto operator=(const model&) -> model& = delete;
+
+  ~model()
+  {
+    delete current.load();
+    delete spare;
+  }
+
+  auto acquire() const -> snapshot
+  {
+    auto& readers = slots[detail::thread_index() % S].readers[epoch.load() & 1];
+    readers.fetch_add(1);
+    return {current.load(), &readers};
+  }
+
+  void publish(const Net& net)
+  {
+    const auto lock = std::lock_guard{writer};
+    const auto version = current.load()->version + 1;
+    if (spare)
+    {
+      spare->net = net;
+      spare->version = version;
+    }
+    else
+      spare = new node{net, version};
+    spare = current.exchange(spare);
+    synchronize();
+  }
+
+private:
+  // waits for every reader which could have loaded the pointer replaced before the call
+  void synchronize()
+  {
+    for (int flip = 0; flip < 2; ++flip)
+    {
+      const auto e = epoch.fetch_add(1);
+      for (auto& s : slots)
+        while (s.readers[e & 1].load() != 0)
+          std::this_thread::yield();
+    }
+  }
+
+  mutable std::array<slot, S> slots{};
+  std::atomic<std::size_t> epoch = 0;
+  std::atomic<node*> current;
+  std::mutex writer;
+  node* spare = nullptr;
+};
+} // namespace mlp
+
+/*
+ * model data forwarding operations
+ *
+ * every call is evaluated against a single consistent version of the network
+ */
+namespace mlp
+{
+template<typename X, typename Net, std::size_t S>
+auto operator>>(const X& x, const model<Net, S>& m)
+{
+  const auto s = m.acquire();
+  return x >> *s;
+}
+} // namespace mlp
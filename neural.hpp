@@ -10,6 +10,9 @@
 #include "math.hpp"
 #include "matrix.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+
 /*
  * activation definition
  */
@@ -23,34 +26,143 @@ enum class act : int
   Tanh
 };
 
-template<act A>
-constexpr auto activation(double x) -> double
+enum class actmode : int
+{
+  Exact,
+  Table
+};
+
+template<act A, std::size_t S = 4096>
+struct actlut;
+
+template<act A, actmode M = actmode::Exact, typename T = double>
+constexpr auto activation(T x) -> T
 {
+  constexpr auto tabulated = M == actmode::Table && std::is_same_v<T, double>;
+
   if constexpr (A == act::Linear)
     return x;
   if constexpr (A == act::ReLU)
-    return std::max(0.0, x);
-  if constexpr (A == act::Sigmoid)
-    return 1.0 / (1.0 + exp(-x));
-  if constexpr (A == act::Tanh)
-    return 2.0 / (1.0 + exp(-2.0 * x)) - 1.0;
+    return std::max(T(0), x);
+  if constexpr (A == act::Sigmoid && tabulated)
+    return actlut<A>::eval(x);
+  else if constexpr (A == act::Sigmoid)
+    return T(1) / (T(1) + exp(-x));
+  if constexpr (A == act::Tanh && tabulated)
+    return actlut<A>::eval(x);
+  else if constexpr (A == act::Tanh)
+    return T(2) / (T(1) + exp(T(-2) * x)) - T(1);
 }
 
-template<std::size_t M>
-constexpr auto activation(act f, const vec<double, M>& x) -> vec<double, M>
+namespace detail::kernel
 {
+template<typename T>
+void activate(act f, actmode m, T* x, std::size_t n);
+} // namespace detail::kernel
+
+template<typename T, std::size_t M>
+constexpr auto activation(act f, const vec<T, M>& x) -> vec<T, M>
+{
+  if (!detail::constant_evaluated())
+  {
+    auto y = x;
+    detail::kernel::activate(f, actmode::Exact, y.data(), M);
+    return y;
+  }
+
   switch (f)
   {
   case act::Linear:
-    return fmap(activation<act::Linear>, x);
+    return fmap(activation<act::Linear, actmode::Exact, T>, x);
   case act::ReLU:
-    return fmap(activation<act::ReLU>, x);
+    return fmap(activation<act::ReLU, actmode::Exact, T>, x);
   case act::Sigmoid:
-    return fmap(activation<act::Sigmoid>, x);
+    return fmap(activation<act::Sigmoid, actmode::Exact, T>, x);
   case act::Tanh:
-    return fmap(activation<act::Tanh>, x);
+    return fmap(activation<act::Tanh, actmode::Exact, T>, x);
   }
+  throw std::invalid_argument("unknown activation");
 }
+
+template<typename T, std::size_t M>
+constexpr auto activation(act f, actmode m, const vec<T, M>& x) -> vec<T, M>
+{
+  if (!detail::constant_evaluated())
+  {
+    auto y = x;
+    detail::kernel::activate(f, m, y.data(), M);
+    return y;
+  }
+
+  if (m == actmode::Table)
+  {
+    if (f == act::Sigmoid)
+      return fmap(activation<act::Sigmoid, actmode::Table, T>, x);
+    if (f == act::Tanh)
+      return fmap(activation<act::Tanh, actmode::Table, T>, x);
+  }
+  return activation(f, x);
+}
+} // namespace mlp
+
+/*
+ * activation lookup tables
+ *
+ * S + 1 samples of the exact activation over [lo, hi] generated at compile time,
+ * linearly interpolated inside the range and saturated outside of it
+ */
+namespace mlp
+{
+template<act A, std::size_t S>
+struct actlut
+{
+  static_assert(A == act::Sigmoid || A == act::Tanh);
+  static_assert(S > 0);
+
+  static constexpr auto hi = A == act::Sigmoid ? 16.0 : 8.0;
+  static constexpr auto lo = -hi;
+  static constexpr auto step = (hi - lo) / static_cast<double>(S);
+  static constexpr auto scale = static_cast<double>(S) / (hi - lo);
+  // max|f''|, 1 / (6 sqrt(3)) for sigmoid and 4 / (3 sqrt(3)) for tanh
+  static constexpr auto curvature = A == act::Sigmoid ? 0.0962250448649376 : 0.7698003589195010;
+
+  static constexpr auto table = []{
+    auto t = vec<double, S + 1>{};
+    for (std::size_t i = 0; i <= S; ++i)
+      t[i] = activation<A>(lo + static_cast<double>(i) * step);
+    return t;
+  }();
+
+  static constexpr auto eval(double x) -> double
+  {
+    if (!(x > lo))
+      return table[0];
+    if (!(x < hi))
+      return table[S];
+
+    const auto t = (x - lo) * scale;
+    const auto i = std::min(static_cast<std::size_t>(t), S - 1);
+    return table[i] + (table[i + 1] - table[i]) * (t - static_cast<double>(i));
+  }
+
+  // max absolute error at the interval midpoints and against the asymptotes,
+  // bounded by step^2 / 8 * max|f''| of the linear interpolation plus the saturation
+  // and the series error of the samples
+  static constexpr auto error = []{
+    const auto abs = [](double x){ return x < 0.0 ? -x : x; };
+    const auto inf = A == act::Sigmoid ? 0.0 : -1.0;
+
+    auto e = std::max(abs(table[0] - inf), abs(table[S] - 1.0));
+    for (std::size_t i = 0; i < S; ++i)
+    {
+      const auto x = lo + (static_cast<double>(i) + 0.5) * step;
+      e = std::max(e, abs(eval(x) - activation<A>(x)));
+    }
+    return e;
+  }();
+
+  static_assert(error <= step * step / 8.0 * curvature + 5e-7);
+};
 } // namespace mlp
 
 /*
@@ -58,38 +170,133 @@ constexpr auto activation(act f, const vec<double, M>& x) -> vec<double, M>
  */
 namespace mlp
 {
-template<act A>
-constexpr auto derivative(double x) -> double
+template<act A, actmode M = actmode::Exact, typename T = double>
+constexpr auto derivative(T x) -> T
 {
   if constexpr (A == act::Linear)
-    return 1;
+    return T(1);
   if constexpr (A == act::ReLU)
-    return x < 0.0 ? 0.0 : 1.0;
+    return x < T(0) ? T(0) : T(1);
   if constexpr (A == act::Sigmoid)
-    return [](double a){ return a * (1.0 - a); }(activation<act::Sigmoid>(x));
+    return [](T a){ return a * (T(1) - a); }(activation<act::Sigmoid, M>(x));
   if constexpr (A == act::Tanh)
-    return 1.0 - pow(activation<act::Tanh>(x), 2);
+    return T(1) - pow(activation<act::Tanh, M>(x), 2);
 }
 
-template<std::size_t M>
-constexpr auto derivative(act f, const vec<double, M>& x) -> vec<double, M>
+namespace detail::kernel
 {
+template<typename T>
+void differentiate(act f, actmode m, T* x, std::size_t n);
+} // namespace detail::kernel
+
+template<typename T, std::size_t M>
+constexpr auto derivative(act f, const vec<T, M>& x) -> vec<T, M>
+{
+  if (!detail::constant_evaluated())
+  {
+    auto y = x;
+    detail::kernel::differentiate(f, actmode::Exact, y.data(), M);
+    return y;
+  }
+
   switch (f)
   {
   case act::Linear:
-    return fmap(derivative<act::Linear>, x);
+    return fmap(derivative<act::Linear, actmode::Exact, T>, x);
   case act::ReLU:
-    return fmap(derivative<act::ReLU>, x);
+    return fmap(derivative<act::ReLU, actmode::Exact, T>, x);
   case act::Sigmoid:
-    return fmap(derivative<act::Sigmoid>, x);
+    return fmap(derivative<act::Sigmoid, actmode::Exact, T>, x);
   case act::Tanh:
-    return fmap(derivative<act::Tanh>, x);
+    return fmap(derivative<act::Tanh, actmode::Exact, T>, x);
   }
+  throw std::invalid_argument("unknown activation");
+}
+
+template<typename T, std::size_t M>
+constexpr auto derivative(act f, actmode m, const vec<T, M>& x) -> vec<T, M>
+{
+  if (!detail::constant_evaluated())
+  {
+    auto y = x;
+    detail::kernel::differentiate(f, m, y.data(), M);
+    return y;
+  }
+
+  if (m == actmode::Table)
+  {
+    if (f == act::Sigmoid)
+      return fmap(derivative<act::Sigmoid, actmode::Table, T>, x);
+    if (f == act::Tanh)
+      return fmap(derivative<act::Tanh, actmode::Table, T>, x);
+  }
+  return derivative(f, x);
 }
 } // namespace mlp
 
+/*
+ * activation kernels
+ *
+ * runtime activation and derivative of n values in place, instantiated once per scalar
+ * type instead of once per vec size
+ */
+namespace mlp::detail::kernel
+{
+template<typename T, typename F>
+void apply(F f, T* x, std::size_t n)
+{
+  for (std::size_t i = 0; i < n; ++i)
+    x[i] = f(x[i]);
+}
+
+template<typename T>
+void activate(act f, actmode m, T* x, std::size_t n)
+{
+  const auto table = m == actmode::Table;
+  switch (f)
+  {
+  case act::Linear:
+    return;
+  case act::ReLU:
+    return apply(activation<act::ReLU, actmode::Exact, T>, x, n);
+  case act::Sigmoid:
+    if (table)
+      return apply(activation<act::Sigmoid, actmode::Table, T>, x, n);
+    return apply(activation<act::Sigmoid, actmode::Exact, T>, x, n);
+  case act::Tanh:
+    if (table)
+      return apply(activation<act::Tanh, actmode::Table, T>, x, n);
+    return apply(activation<act::Tanh, actmode::Exact, T>, x, n);
+  }
+}
+
+template<typename T>
+void differentiate(act f, actmode m, T* x, std::size_t n)
+{
+  const auto table = m == actmode::Table;
+  switch (f)
+  {
+  case act::Linear:
+    return apply(derivative<act::Linear, actmode::Exact, T>, x, n);
+  case act::ReLU:
+    return apply(derivative<act::ReLU, actmode::Exact, T>, x, n);
+  case act::Sigmoid:
+    if (table)
+      return apply(derivative<act::Sigmoid, actmode::Table, T>, x, n);
+    return apply(derivative<act::Sigmoid, actmode::Exact, T>, x, n);
+  case act::Tanh:
+    if (table)
+      return apply(derivative<act::Tanh, actmode::Table, T>, x, n);
+    return apply(derivative<act::Tanh, actmode::Exact, T>, x, n);
+  }
+}
+} // namespace mlp::detail::kernel
+
 /*
  * loss definition
+ *
+ * predictions are clamped away from 0 and 1 by LogLoss so that saturated outputs
+ * give a finite loss and derivative
  */
 namespace mlp
 {
@@ -99,32 +306,45 @@ enum class lossf : int
   LogLoss
 };
 
-template<lossf L>
-constexpr auto loss(double y_real, double y_pred) -> double
+namespace detail
+{
+template<typename T>
+constexpr auto probability(T y) -> T
+{
+  return std::clamp(y, T(1e-15), T(1) - T(1e-15));
+}
+} // namespace detail
+
+template<lossf L, typename T = double>
+constexpr auto loss(T y_real, T y_pred) -> T
 {
   if constexpr (L == lossf::MSE)
     return pow(y_real - y_pred, 2);
   if constexpr (L == lossf::LogLoss)
-    return y_real * ln(y_pred) + (1.0 - y_real) * ln(1.0 - y_pred);
+  {
+    const auto p = detail::probability(y_pred);
+    return y_real * ln(p) + (T(1) - y_real) * ln(T(1) - p);
+  }
 }
 
-template<std::size_t M>
-constexpr auto loss(lossf f, const vec<double, M>& y_real, const vec<double, M>& y_pred) -> double
+template<typename T, std::size_t M>
+constexpr auto loss(lossf f, const vec<T, M>& y_real, const vec<T, M>& y_pred) -> T
 {
   switch (f)
   {
   case lossf::MSE:
-    return fold(std::plus{}, 0.0, zip(loss<lossf::MSE>, y_real, y_pred)) / static_cast<double>(M);
+    return reduce(std::plus{}, T(0), zip(loss<lossf::MSE, T>, y_real, y_pred)) / T(M);
   case lossf::LogLoss:
-    return fold(std::plus{}, 0.0, zip(loss<lossf::LogLoss>, y_real, y_pred)) / -static_cast<double>(M);
+    return reduce(std::plus{}, T(0), zip(loss<lossf::LogLoss, T>, y_real, y_pred)) / -T(M);
   }
+  throw std::invalid_argument("unknown loss");
 }
 
-template<std::size_t M, std::size_t N>
-constexpr auto loss(lossf f, const mat<double, M, N>& y_real, const mat<double, M, N>& y_pred) -> double
+template<typename T, std::size_t M, std::size_t N>
+constexpr auto loss(lossf f, const mat<T, M, N>& y_real, const mat<T, M, N>& y_pred) -> T
 {
-  return fold(std::plus{}, 0.0, zip([f](const vec<double, N>& y_r, const vec<double, N>& y_p){
-    return loss(f, y_r, y_p); }, y_real, y_pred)) / static_cast<double>(N);
+  return reduce(std::plus{}, T(0), zip([f](const vec<T, N>& y_r, const vec<T, N>& y_p){
+    return loss(f, y_r, y_p); }, y_real, y_pred)) / T(N);
 }
 } // namespace mlp
 
@@ -133,24 +353,28 @@ constexpr auto loss(lossf f, const mat<double, M, N>& y_real, const mat<double,
  */
 namespace mlp
 {
-template<lossf L>
-constexpr auto derivative(double y_real, double y_pred) -> double
+template<lossf L, typename T = double>
+constexpr auto derivative(T y_real, T y_pred) -> T
 {
   if constexpr (L == lossf::MSE)
-    return -2 * (y_real - y_pred);
+    return T(-2) * (y_real - y_pred);
   if constexpr (L == lossf::LogLoss)
-    return (y_pred - y_real) / (y_pred * (1.0 - y_pred));
+  {
+    const auto p = detail::probability(y_pred);
+    return (p - y_real) / (p * (T(1) - p));
+  }
 }
 
-template<std::size_t M>
-constexpr auto derivative(lossf f, const vec<double, M>& y_real, const vec<double, M>& y_pred) -> vec<double, M>
+template<typename T, std::size_t M>
+constexpr auto derivative(lossf f, const vec<T, M>& y_real, const vec<T, M>& y_pred) -> vec<T, M>
 {
   switch (f)
   {
   case lossf::MSE:
-    return zip(derivative<lossf::MSE>, y_real, y_pred);
+    return zip(derivative<lossf::MSE, T>, y_real, y_pred);
   case lossf::LogLoss:
-    return zip(derivative<lossf::LogLoss>, y_real, y_pred);
+    return zip(derivative<lossf::LogLoss, T>, y_real, y_pred);
   }
+  throw std::invalid_argument("unknown loss");
 }
 } // namespace mlp
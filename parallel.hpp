@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "matrix.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * thread pool
+ *
+ * fixed set of workers executing index ranges together with the calling thread.
+ * Calls made from inside a task run all of their indices on the thread of the task,
+ * concurrent callers are serialized. The first exception thrown by a task is rethrown
+ * on the caller once every task is done
+ */
+namespace mlp::detail
+{
+class threadpool
+{
+public:
+  explicit threadpool(std::size_t n = std::max(1u, std::thread::hardware_concurrency()) - 1)
+  {
+    for (std::size_t i = 0; i < n; ++i)
+      workers.emplace_back([this]{ work(); });
+  }
+
+  threadpool(const threadpool&) = delete;
+  auto operator=(const threadpool&) -> threadpool& = delete;
+
+  ~threadpool()
+  {
+    {
+      const auto lock = std::lock_guard{mutex};
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers)
+      w.join();
+  }
+
+  auto size() const -> std::size_t
+  {
+    return workers.size() + 1;
+  }
+
+  // while alive the calls made by the current thread run all of their indices on it,
+  // for background threads which must not hold up the callers of the pool
+  class serial
+  {
+  public:
+    serial() : was{std::exchange(inside(), true)} {}
+    ~serial() { inside() = was; }
+
+  private:
+    const bool was;
+  };
+
+  // calls f(i) for every i in [0, n) and returns when all calls are done
+  template<typename F>
+  void run(std::size_t n, F&& f)
+  {
+    if (workers.empty() || n < 2 || inside())
+    {
+      for (std::size_t i = 0; i < n; ++i)
+        f(i);
+      return;
+    }
+
+    const auto turn = std::lock_guard{caller};
+    const auto nested = serial{};
+    {
+      const auto lock = std::lock_guard{mutex};
+      job = [&f](std::size_t i){ f(i); };
+      tasks = n;
+      next = 0;
+      pending = workers.size();
+      ++generation;
+    }
+    wake.notify_all();
+    execute();
+
+    auto lock = std::unique_lock{mutex};
+    done.wait(lock, [this]{ return pending == 0; });
+    job = nullptr;
+    if (error)
+      std::rethrow_exception(std::exchange(error, nullptr));
+  }
+
+private:
+  // true on the workers and on a caller while it runs tasks
+  static auto inside() -> bool&
+  {
+    thread_local auto i = false;
+    return i;
+  }
+
+  void execute()
+  {
+    for (auto i = next.fetch_add(1); i < tasks; i = next.fetch_add(1))
+    {
+      try
+      {
+        job(i);
+      }
+      catch (...)
+      {
+        const auto lock = std::lock_guard{mutex};
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  }
+
+  void work()
+  {
+    inside() = true;
+    for (auto seen = std::size_t{};;)
+    {
+      {
+        auto lock = std::unique_lock{mutex};
+        wake.wait(lock, [&]{ return stop || generation != seen; });
+        if (stop)
+          return;
+        seen = generation;
+      }
+      execute();
+      {
+        const auto lock = std::lock_guard{mutex};
+        if (--pending == 0)
+          done.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex caller;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::function<void(std::size_t)> job;
+  std::exception_ptr error;
+  std::size_t tasks = 0;
+  std::atomic<std::size_t> next = 0;
+  std::size_t pending = 0;
+  std::size_t generation = 0;
+  bool stop = false;
+};
+
+inline auto pool() -> threadpool&
+{
+  static auto p = threadpool{};
+  return p;
+}
+
+// rows of tuned products are split over the pool, a product computed inside a task of
+// the pool keeps its rows on the thread of the task
+inline void execute(std::size_t n, task f, const void* context)
+{
+  pool().run(n, [f, context](std::size_t i){ f(context, i); });
+}
+
+inline const auto installed = (executor().store(&execute, std::memory_order_release), true);
+} // namespace mlp::detail
+
+/*
+ * execution policies
+ *
+ * mirror the standard ones and are implemented over the internal thread pool
+ */
+namespace mlp::execution
+{
+struct sequenced_policy {};
+struct unsequenced_policy {};
+struct parallel_policy {};
+struct parallel_unsequenced_policy {};
+
+inline constexpr auto seq = sequenced_policy{};
+inline constexpr auto unseq = unsequenced_policy{};
+inline constexpr auto par = parallel_policy{};
+inline constexpr auto par_unseq = parallel_unsequenced_policy{};
+
+template<typename P>
+inline constexpr auto is_execution_policy_v =
+  std::is_same_v<P, sequenced_policy> || std::is_same_v<P, unsequenced_policy> ||
+  std::is_same_v<P, parallel_policy> || std::is_same_v<P, parallel_unsequenced_policy>;
+
+template<typename P>
+inline constexpr auto is_parallel_policy_v =
+  std::is_same_v<P, parallel_policy> || std::is_same_v<P, parallel_unsequenced_policy>;
+
+template<typename P>
+using enable_if_policy_t = std::enable_if_t<is_execution_policy_v<std::decay_t<P>>>;
+} // namespace mlp::execution
+
+/*
+ * parallel loops
+ *
+ * extents are split into chunks of a fixed size independent of the number of threads
+ * so that the results are deterministic
+ */
+namespace mlp
+{
+inline constexpr auto grain = std::size_t{4096};
+
+namespace detail
+{
+template<typename F>
+void parallel_for(std::size_t n, std::size_t chunk, F&& f)
+{
+  pool().run((n + chunk - 1) / chunk, [&](std::size_t c){
+    for (std::size_t i = c * chunk, e = std::min(n, i + chunk); i < e; ++i)
+      f(i);
+  });
+}
+
+template<typename F, typename A, typename B, std::size_t M>
+auto parallel_reduce(F& f, const A& z, const vec<B, M>& x) -> std::invoke_result_t<F, A, B>
+{
+  using R = std::invoke_result_t<F, A, B>;
+
+  constexpr auto chunks = (M + grain - 1) / grain;
+  auto partials = std::vector<R>(chunks);
+  pool().run(chunks, [&](std::size_t c){
+    partials[c] = pairwise<R>(f, x.data() + c * grain, std::min(grain, M - c * grain));
+  });
+  return f(z, pairwise<R>(f, partials.data(), chunks));
+}
+
+// rows per chunk of a row-wise parallel loop over a mat with N columns
+template<std::size_t N>
+inline constexpr auto rows = std::max(std::size_t{1}, grain / std::max(std::size_t{1}, N));
+} // namespace detail
+
+// f is to be associative as for reduce, the chunks are reduced in parallel and then
+// combined with each other
+template<typename F, typename A, typename B, std::size_t M>
+constexpr auto parallel_reduce(F&& f, const A& z, const vec<B, M>& x) -> std::conditional_t<M == 0, A, std::invoke_result_t<F, A, B>>
+{
+  if constexpr (M <= grain)
+    return reduce(f, z, x);
+  else
+  {
+    if (detail::constant_evaluated())
+      return reduce(f, z, x);
+    return detail::parallel_reduce(f, z, x);
+  }
+}
+} // namespace mlp
+
+/*
+ * vec functional with execution policies
+ *
+ * parallel policies chunk large extents over the thread pool, fold with a parallel or
+ * unsequenced policy requires an associative function like std::reduce does
+ */
+namespace mlp
+{
+template<typename P, typename F, typename A, std::size_t M, typename = execution::enable_if_policy_t<P>>
+constexpr auto fmap(P&&, F&& f, const vec<A, M>& a) -> vec<std::invoke_result_t<F, A>, M>
+{
+  if constexpr (!execution::is_parallel_policy_v<std::decay_t<P>> || M <= grain)
+    return fmap(f, a);
+  else
+  {
+    if (detail::constant_evaluated())
+      return fmap(f, a);
+
+    auto b = vec<std::invoke_result_t<F, A>, M>{};
+    detail::parallel_for(M, grain, [&](std::size_t i){ b[i] = f(a[i]); });
+    return b;
+  }
+}
+
+template<typename P, typename F, typename A, typename B, std::size_t M, typename = execution::enable_if_policy_t<P>>
+constexpr auto zip(P&&, F&& f, const vec<A, M>& a, const vec<B, M>& b) -> vec<std::invoke_result_t<F, A, B>, M>
+{
+  if constexpr (!execution::is_parallel_policy_v<std::decay_t<P>> || M <= grain)
+    return zip(f, a, b);
+  else
+  {
+    if (detail::constant_evaluated())
+      return zip(f, a, b);
+
+    auto c = vec<std::invoke_result_t<F, A, B>, M>{};
+    detail::parallel_for(M, grain, [&](std::size_t i){ c[i] = f(a[i], b[i]); });
+    return c;
+  }
+}
+
+template<typename P, typename F, typename A, typename B, std::size_t M, typename = execution::enable_if_policy_t<P>>
+constexpr auto fold(P&&, F&& f, const A& z, const vec<B, M>& x) -> std::conditional_t<M == 0, A, std::invoke_result_t<F, A, B>>
+{
+  if constexpr (std::is_same_v<std::decay_t<P>, execution::sequenced_policy>)
+    return fold(f, z, x);
+  else if constexpr (std::is_same_v<std::decay_t<P>, execution::unsequenced_policy>)
+    return reduce(f, z, x);
+  else
+    return parallel_reduce(f, z, x);
+}
+} // namespace mlp
+
+/*
+ * mat functional with execution policies
+ */
+namespace mlp
+{
+template<typename P, typename F, typename A, std::size_t M, std::size_t N, typename = execution::enable_if_policy_t<P>>
+constexpr auto fmap(P&&, F&& f, const mat<A, M, N>& a) -> mat<std::invoke_result_t<F, A>, M, N>
+{
+  if constexpr (!execution::is_parallel_policy_v<std::decay_t<P>> || M * N <= grain)
+    return fmap(f, a);
+  else
+  {
+    if (detail::constant_evaluated())
+      return fmap(f, a);
+
+    auto b = mat<std::invoke_result_t<F, A>, M, N>{};
+    detail::parallel_for(M, detail::rows<N>, [&](std::size_t i){
+      for (std::size_t j = 0; j < N; ++j)
+        b[i][j] = f(a[i][j]);
+    });
+    return b;
+  }
+}
+
+template<typename P, typename F, typename A, typename B, std::size_t M, std::size_t N, typename = execution::enable_if_policy_t<P>>
+constexpr auto zip(P&&, F&& f, const mat<A, M, N>& a, const mat<B, M, N>& b) -> mat<std::invoke_result_t<F, A, B>, M, N>
+{
+  if constexpr (!execution::is_parallel_policy_v<std::decay_t<P>> || M * N <= grain)
+    return zip(f, a, b);
+  else
+  {
+    if (detail::constant_evaluated())
+      return zip(f, a, b);
+
+    auto c = mat<std::invoke_result_t<F, A, B>, M, N>{};
+    detail::parallel_for(M, detail::rows<N>, [&](std::size_t i){
+      for (std::size_t j = 0; j < N; ++j)
+        c[i][j] = f(a[i][j], b[i][j]);
+    });
+    return c;
+  }
+}
+} // namespace mlp
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "mlp.hpp"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <system_error>
+
+/*
+ * resident definition
+ *
+ * copy of a network placed in memory mapped with 2 MiB pages, explicit huge pages
+ * when the system has them reserved and transparent huge pages otherwise. The pages
+ * are pre-faulted, optionally locked into memory, and warmed up by a forward pass
+ * so that the first requests neither fault nor miss the TLB on cold pages.
+ * Page fault counts are process-wide
+ */
+namespace mlp
+{
+enum class pages : int
+{
+  Small,
+  Transparent,
+  Huge
+};
+
+struct faults
+{
+  long minor;
+  long major;
+};
+
+template<typename Net>
+class resident
+{
+  static constexpr auto huge = std::size_t{2} << 20;
+
+public:
+  struct report
+  {
+    pages p;
+    bool locked;
+    std::size_t bytes;
+    faults load;
+    faults warmup;
+  };
+
+  explicit resident(const Net& net, bool lock = false)
+    : length{(sizeof(Net) + huge - 1) / huge * huge}
+  {
+    const auto before = count();
+
+    base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (base != MAP_FAILED)
+      r.p = pages::Huge;
+    else
+    {
+      // over-allocated by a huge page to align the start for the transparent ones
+      length += huge;
+      base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (base == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "resident mmap");
+      r.p = ::madvise(base, length, MADV_HUGEPAGE) == 0 ? pages::Transparent : pages::Small;
+    }
+
+    const auto start = (reinterpret_cast<std::uintptr_t>(base) + huge - 1) / huge * huge;
+    n = new (reinterpret_cast<void*>(start)) Net(net);
+
+    r.bytes = sizeof(Net);
+    if (lock)
+    {
+      if (::mlock(n, sizeof(Net)) != 0)
+      {
+        const auto e = errno;
+        n->~Net();
+        ::munmap(base, length);
+        throw std::system_error(e, std::generic_category(), "resident mlock");
+      }
+      r.locked = true;
+    }
+
+    const auto loaded = count();
+    r.load = {loaded.minor - before.minor, loaded.major - before.major};
+
+    warm();
+    const auto warmed = count();
+    r.warmup = {warmed.minor - loaded.minor, warmed.major - loaded.major};
+  }
+
+  resident(const resident&) = delete;
+  auto operator=(const resident&) -> resident& = delete;
+
+  ~resident()
+  {
+    if (r.locked)
+      ::munlock(n, sizeof(Net));
+    n->~Net();
+    ::munmap(base, length);
+  }
+
+  auto operator*() const -> const Net& { return *n; }
+  auto operator->() const -> const Net* { return n; }
+
+  auto stats() const -> const report& { return r; }
+
+  // page faults of the process so far
+  static auto count() -> faults
+  {
+    auto u = rusage{};
+    ::getrusage(RUSAGE_SELF, &u);
+    return {u.ru_minflt, u.ru_majflt};
+  }
+
+private:
+  // touches every page of the weights and the stack used by a forward pass
+  void warm() const
+  {
+    const auto bytes = reinterpret_cast<const volatile unsigned char*>(n);
+    auto sum = 0u;
+    for (std::size_t i = 0; i < sizeof(Net); i += 4096)
+      sum += bytes[i];
+
+    const auto y = input_t<Net>{} >> *n;
+    [[maybe_unused]] const volatile auto touched = sum;
+    [[maybe_unused]] const volatile auto forwarded = y[0];
+  }
+
+  std::size_t length;
+  void* base = nullptr;
+  Net* n = nullptr;
+  report r{};
+};
+} // namespace mlp
+
+/*
+ * resident data forwarding operations
+ */
+namespace mlp
+{
+template<typename X, typename Net>
+auto operator>>(const X& x, const resident<Net>& r)
+{
+  return x >> *r;
+}
+} // namespace mlp
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "mlp.hpp"
+
+/*
+ * singular value decomposition
+ *
+ * thin decomposition a = u * diag(s) * v of a MxN mat into K = min(M, N) singular
+ * values in descending order, the columns of u and the rows of v being the left and
+ * the right singular vectors. Computed by the one-sided Jacobi method which costs
+ * O(K^2 * max(M, N)) per sweep and is meant for small and medium sizes
+ */
+namespace mlp
+{
+template<typename T, std::size_t M, std::size_t N>
+struct usv
+{
+  static constexpr auto K = std::min(M, N);
+
+  mat<T, M, K> u;
+  vec<T, K> s;
+  mat<T, K, N> v;
+};
+
+namespace detail
+{
+// orthogonalizes the rows of b by plane rotations accumulated in j, so that b = j^T * d * y
+template<typename T, std::size_t K, std::size_t L>
+constexpr auto jacobi(mat<T, K, L> b) -> usv<T, K, L>
+{
+  static_assert(K <= L);
+
+  auto j = mat<T, K, K>{};
+  for (std::size_t k = 0; k < K; ++k)
+    j[k][k] = T(1);
+
+  const auto dot = [](const vec<T, L>& x, const vec<T, L>& y){
+    return reduce(std::plus{}, T(0), zip(std::multiplies{}, x, y));
+  };
+
+  // squared row norms are updated by the rotations and recomputed every sweep
+  auto n = vec<T, K>{};
+  for (int sweep = 0; sweep < 64; ++sweep)
+  {
+    for (std::size_t k = 0; k < K; ++k)
+      n[k] = dot(b[k], b[k]);
+
+    auto rotated = false;
+    for (std::size_t p = 0; p + 1 < K; ++p)
+      for (std::size_t q = p + 1; q < K; ++q)
+      {
+        const auto alpha = n[p];
+        const auto beta = n[q];
+        const auto gamma = dot(b[p], b[q]);
+        if (gamma == T(0) || (gamma < T(0) ? -gamma : gamma) <= T(1e-15) * sqrt(alpha * beta))
+          continue;
+
+        const auto zeta = (beta - alpha) / (T(2) * gamma);
+        const auto t = (zeta < T(0) ? T(-1) : T(1)) / ((zeta < T(0) ? -zeta : zeta) + sqrt(T(1) + zeta * zeta));
+        const auto c = T(1) / sqrt(T(1) + t * t);
+        const auto s = c * t;
+
+        const auto rotate = [c, s](auto& x, auto& y){
+          for (std::size_t i = 0; i < x.size(); ++i)
+          {
+            const auto x_i = x[i];
+            x[i] = c * x_i - s * y[i];
+            y[i] = s * x_i + c * y[i];
+          }
+        };
+        rotate(b[p], b[q]);
+        rotate(j[p], j[q]);
+        n[p] = alpha - t * gamma;
+        n[q] = beta + t * gamma;
+        rotated = true;
+      }
+    if (!rotated)
+      break;
+  }
+
+  auto d = usv<T, K, L>{};
+  for (std::size_t k = 0; k < K; ++k)
+    d.s[k] = sqrt(dot(b[k], b[k]));
+
+  // selection sort of the singular values with their vectors
+  for (std::size_t k = 0; k < K; ++k)
+  {
+    auto top = k;
+    for (std::size_t i = k + 1; i < K; ++i)
+      if (d.s[top] < d.s[i])
+        top = i;
+
+    const auto s_k = d.s[k];
+    const auto b_k = b[k];
+    const auto j_k = j[k];
+    d.s[k] = d.s[top];
+    b[k] = b[top];
+    j[k] = j[top];
+    d.s[top] = s_k;
+    b[top] = b_k;
+    j[top] = j_k;
+
+    d.v[k] = d.s[k] == T(0) ? vec<T, L>{} : b[k] * (T(1) / d.s[k]);
+  }
+  d.u = transpose(j);
+  return d;
+}
+} // namespace detail
+
+template<typename T, std::size_t M, std::size_t N>
+constexpr auto svd(const mat<T, M, N>& a) -> usv<T, M, N>
+{
+  if constexpr (M <= N)
+    return detail::jacobi(a);
+  else
+  {
+    const auto d_t = detail::jacobi(transpose(a));
+    return {transpose(d_t.v), d_t.s, transpose(d_t.u)};
+  }
+}
+} // namespace mlp
+
+/*
+ * layer factorization
+ *
+ * a layer<I, O> is replaced by a Linear layer<I, R> followed by a layer<R, O> with
+ * the activation and the biases of the original one, their weights being the rank R
+ * truncation of the decomposition of the original weights with the singular values
+ * split evenly between the two. The cost of forwarding drops from I * O to
+ * R * (I + O) multiplications and the result can be fine-tuned by fit
+ */
+namespace mlp
+{
+// smallest rank which keeps the given share of the sum of squared singular values
+template<std::size_t I, std::size_t O, typename T>
+constexpr auto rank(const layer<I, O, T>& l, double energy) -> std::size_t
+{
+  const auto d = svd(l.w);
+  const auto total = reduce(std::plus{}, T(0), zip(std::multiplies{}, d.s, d.s));
+
+  auto kept = T(0);
+  for (std::size_t r = 0; r < d.s.size(); ++r)
+  {
+    if (!(kept < T(energy) * total))
+      return r;
+    kept += d.s[r] * d.s[r];
+  }
+  return d.s.size();
+}
+
+template<std::size_t R, std::size_t I, std::size_t O, typename T>
+constexpr auto factorize(const layer<I, O, T>& l) -> mlp<layer<I, R, T>, layer<R, O, T>>
+{
+  static_assert(0 < R && R <= std::min(I, O));
+
+  const auto d = svd(l.w);
+
+  auto li = layer<I, R, T>{act::Linear, {}, {}};
+  auto lo = layer<R, O, T>{l.a, {}, l.b, l.m};
+  for (std::size_t r = 0; r < R; ++r)
+  {
+    const auto s_r = sqrt(d.s[r]);
+    li.w[r] = d.v[r] * s_r;
+    for (std::size_t o = 0; o < O; ++o)
+      lo.w[o][r] = d.u[o][r] * s_r;
+  }
+  return li + lo;
+}
+} // namespace mlp
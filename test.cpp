@@ -0,0 +1,1178 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "blas.hpp"
+#include "cache.hpp"
+#include "checkpoint.hpp"
+#include "fixed.hpp"
+#include "flat.hpp"
+#include "lbfgs.hpp"
+#include "mlp.hpp"
+#include "model.hpp"
+#include "parallel.hpp"
+#include "resident.hpp"
+#include "svd.hpp"
+#include "tune.hpp"
+#include "validation.hpp"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace
+{
+auto failures = 0;
+
+void check(bool ok, const char* what)
+{
+  if (!ok)
+  {
+    ++failures;
+    std::cout << "\tfailed: " << what << '\n';
+  }
+}
+
+constexpr auto xor_net = mlp::layer<2, 4>{mlp::act::Tanh, {{{.1, .2}, {.3, .4}, {.5, -.6}, {-.2, .7}}}, {}} +
+  mlp::layer<4, 1>{mlp::act::Sigmoid, {{{.1, .2, .3, -.4}}}, {}};
+constexpr auto xor_x = mlp::mat<double, 4, 2>{{{0, 0}, {0, 1}, {1, 0}, {1, 1}}};
+constexpr auto xor_y = mlp::mat<double, 4, 1>{{{0}, {1}, {1}, {0}}};
+
+// max absolute elementwise difference
+template<typename T, std::size_t M>
+constexpr auto distance(const mlp::vec<T, M>& a, const mlp::vec<T, M>& b) -> T
+{
+  auto d = T{};
+  for (std::size_t i = 0; i < M; ++i)
+    d = std::max(d, a[i] < b[i] ? b[i] - a[i] : a[i] - b[i]);
+  return d;
+}
+
+constexpr auto net = mlp::layer<4, 3>{mlp::act::Tanh, {{{.1, -.2, .3, .4}, {.5, .6, -.7, .8}, {-.9, .1, .2, .3}}}, {.1, .2, .3}} +
+  mlp::layer<3, 2>{mlp::act::Sigmoid, {{{.4, .5, -.6}, {.7, -.8, .9}}}, {-.1, .1}};
+
+constexpr auto embedded = mlp::embedding<5, 3>{mlp::pooling::Mean, {{{.1, .2, .3}, {-.4, .5, .6}, {.7, -.8, .9}, {.2, .1, -.3}, {.5, .5, .5}}}} +
+  mlp::layer<3, 1>{mlp::act::Sigmoid, {{{.3, -.2, .1}}}, {.1}};
+constexpr auto ids = mlp::mat<std::size_t, 3, 2>{{{0, 1}, {2, 3}, {1, 3}}};
+constexpr auto labels = mlp::mat<double, 3, 1>{{{1}, {0}, {1}}};
+
+// one gradient descent step of a two-layer network over all rows and columns, the way the
+// backward pass computed it before zero deltas and inputs were skipped
+template<typename Net, std::size_t I, std::size_t O>
+constexpr auto dense_step(Net net, const mlp::fitparms& par, const mlp::vec<double, I>& x, const mlp::vec<double, O>& y) -> Net
+{
+  using namespace mlp;
+
+  auto& l_0 = std::get<0>(net);
+  auto& l_1 = std::get<1>(net);
+  const auto z_0 = l_0.w * x + l_0.b;
+  const auto a_0 = activation(l_0.a, z_0);
+  const auto z_1 = l_1.w * a_0 + l_1.b;
+  const auto d_1 = zip(std::multiplies{}, derivative(l_1.a, z_1), derivative(par.loss, y, activation(l_1.a, z_1)));
+  const auto d_0 = zip(std::multiplies{}, derivative(l_0.a, z_0), transpose(l_1.w) * d_1);
+
+  const auto descend = [&par](auto& l, const auto& x_l, const auto& d){
+    for (std::size_t o = 0; o < d.size(); ++o)
+    {
+      for (std::size_t i = 0; i < x_l.size(); ++i)
+        l.w[o][i] = l.w[o][i] - d[o] * x_l[i] * par.rate;
+      l.b[o] = l.b[o] - d[o] * par.rate;
+    }
+  };
+  descend(l_1, a_0, d_1);
+  descend(l_0, x, d_0);
+  return net;
+}
+
+// ReLU network with inactive hidden neurons for the sparse inputs below
+constexpr auto relu_net = mlp::layer<6, 4>{mlp::act::ReLU, {{{.1, -.2, .3, .4, -.5, .2}, {-.5, .6, -.7, .8, .1, -.3}, {-.9, .1, .2, -.3, .4, .5}, {.2, -.4, .6, -.1, .3, -.2}}}, {.1, -.6, .05, -.2}} +
+  mlp::layer<4, 2>{mlp::act::Sigmoid, {{{.4, .5, -.6, .3}, {.7, -.8, .9, -.2}}}, {-.1, .1}};
+constexpr auto relu_x = mlp::mat<double, 3, 6>{{{.5, 0, 0, 0, 0, .3}, {0, 0, 1, 0, 0, 0}, {.2, -.4, .6, -.1, .3, .9}}};
+constexpr auto relu_y = mlp::mat<double, 3, 2>{{{1, 0}, {0, 1}, {1, 1}}};
+
+// binary layer over two words of inputs and its output computed from the signs directly
+constexpr auto bin_error()
+{
+  auto w = mlp::mat<double, 2, 70>{};
+  auto x = mlp::vec<double, 70>{};
+  for (std::size_t i = 0; i < 70; ++i)
+  {
+    w[0][i] = static_cast<double>(i % 7) / 7.0 - .5;
+    w[1][i] = static_cast<double>(i % 5) / 10.0 - .15;
+    x[i] = static_cast<double>(i % 3) - 1.0;
+  }
+  const auto l = mlp::binlayer<70, 2>{mlp::act::Linear, w, {.25, -.5}};
+  const auto y = x >> l;
+
+  auto y_r = mlp::vec<double, 2>{};
+  auto s_r = mlp::vec<double, 2>{};
+  for (std::size_t o = 0; o < 2; ++o)
+  {
+    auto dot = 0;
+    for (std::size_t i = 0; i < 70; ++i)
+    {
+      dot += (w[o][i] < 0.0) == (x[i] < 0.0) ? 1 : -1;
+      s_r[o] += w[o][i] < 0.0 ? -w[o][i] : w[o][i];
+    }
+    s_r[o] /= 70.0;
+    y_r[o] = l.s[o] * dot + l.b[o];
+  }
+  return std::max(distance(y, y_r), distance(l.s, s_r));
+}
+
+// one straight-through step of a binary layer behind a real one against the estimator
+// written out: the shadow weights move by the sign of the input and are clipped to [-1, 1],
+// the input gradient flows through the signs of the weights where |x| <= 1
+constexpr auto ste_error()
+{
+  using namespace mlp;
+
+  auto net = layer<2, 4>{act::Tanh, {}, {}} + binlayer<4, 2>{act::Tanh, {{{.5, -.25, .75, -.98}, {-.5, .5, .1, .2}}}, {.1, -.1}};
+  const auto l = std::get<1>(net);
+  const auto par = fitparms{1, .5, lossf::MSE};
+  const auto x = vec<double, 4>{.5, -2.0, .25, -.75};
+  const auto y = vec<double, 2>{1, 0};
+
+  const auto z = detail::affine(l, x);
+  const auto delta = zip(std::multiplies{}, derivative(act::Tanh, z), derivative(lossf::MSE, y, activation(act::Tanh, z)));
+  const auto g = backpropagate<1>(net, par, x, y);
+  const auto& l_1 = std::get<1>(net);
+
+  auto d = 0.0;
+  auto g_r = vec<double, 4>{};
+  for (std::size_t o = 0; o < 2; ++o)
+  {
+    for (std::size_t i = 0; i < 4; ++i)
+    {
+      g_r[i] = g_r[i] + (l.w[o][i] < 0.0 ? -1.0 : 1.0) * (delta[o] * l.s[o]);
+      const auto w = std::clamp(l.w[o][i] - delta[o] * l.s[o] * (x[i] < 0.0 ? -1.0 : 1.0) * par.rate, -1.0, 1.0);
+      d = std::max(d, w < l_1.w[o][i] ? l_1.w[o][i] - w : w - l_1.w[o][i]);
+    }
+    d = std::max(d, l_1.p[o][0] == detail::pack(l_1.w[o])[0] ? 0.0 : 1.0);
+  }
+  g_r[1] = 0.0;
+  return std::max(d, distance(g, g_r));
+}
+
+// largest error of the reconstruction of a from its decomposition and of the
+// orthonormality of the singular vectors, or 1 if the values are not in descending order
+template<std::size_t M, std::size_t N>
+constexpr auto svd_error(const mlp::mat<double, M, N>& a) -> double
+{
+  const auto d = mlp::svd(a);
+  constexpr auto K = std::min(M, N);
+
+  auto e = 0.0;
+  const auto gap = [&e](double x, double y){ e = std::max(e, x < y ? y - x : x - y); };
+  for (std::size_t m = 0; m < M; ++m)
+    for (std::size_t n = 0; n < N; ++n)
+    {
+      auto a_mn = 0.0;
+      for (std::size_t k = 0; k < K; ++k)
+        a_mn += d.u[m][k] * d.s[k] * d.v[k][n];
+      gap(a_mn, a[m][n]);
+    }
+  for (std::size_t p = 0; p < K; ++p)
+    for (std::size_t q = 0; q < K; ++q)
+    {
+      auto u_pq = 0.0;
+      for (std::size_t m = 0; m < M; ++m)
+        u_pq += d.u[m][p] * d.u[m][q];
+      auto v_pq = 0.0;
+      for (std::size_t n = 0; n < N; ++n)
+        v_pq += d.v[p][n] * d.v[q][n];
+      gap(u_pq, p == q ? 1.0 : 0.0);
+      gap(v_pq, p == q ? 1.0 : 0.0);
+    }
+  for (std::size_t k = 1; k < K; ++k)
+    e = d.s[k] <= d.s[k - 1] ? e : 1.0;
+  return e;
+}
+
+// layer with weights of rank 2
+constexpr auto low = []{
+  const auto u = mlp::mat<double, 2, 4>{{{1, -2, .5, 3}, {.5, 1, -1, .25}}};
+  const auto v = mlp::mat<double, 2, 6>{{{.2, .1, -.3, .4, .5, -.1}, {-.6, .2, .1, .3, -.2, .4}}};
+  auto l = mlp::layer<6, 4>{mlp::act::Tanh, {}, {.1, -.2, .3, 0}};
+  for (std::size_t o = 0; o < 4; ++o)
+    for (std::size_t i = 0; i < 6; ++i)
+      l.w[o][i] = u[0][o] * v[0][i] + u[1][o] * v[1][i];
+  return l;
+}();
+
+template<typename T>
+auto same(const T& a, const T& b) -> bool
+{
+  return a == b;
+}
+
+template<typename T, std::size_t M>
+auto same(const std::array<T, M>& a, const std::array<T, M>& b) -> bool
+{
+  for (std::size_t i = 0; i < M; ++i)
+    if (!same(a[i], b[i]))
+      return false;
+  return true;
+}
+
+// operands whose partial sums are inexact, so that another summation order shows in the
+// last bits of the results
+template<typename T>
+struct kernel_case
+{
+  mlp::mat<T, 7, 13> a;
+  mlp::mat<T, 13, 5> b;
+  mlp::vec<T, 13> x;
+};
+
+template<typename T>
+constexpr auto kernel_operands() -> kernel_case<T>
+{
+  auto k = kernel_case<T>{};
+  for (std::size_t i = 0; i < 7; ++i)
+    for (std::size_t j = 0; j < 13; ++j)
+      k.a[i][j] = T(1.0 / static_cast<double>(i * 13 + j + 3) - .1);
+  for (std::size_t j = 0; j < 13; ++j)
+  {
+    k.x[j] = T(.3 - 1.0 / static_cast<double>(j + 7));
+    for (std::size_t p = 0; p < 5; ++p)
+      k.b[j][p] = T(1.0 / static_cast<double>(j * 5 + p + 2) - .05);
+  }
+  return k;
+}
+
+template<typename T>
+struct kernel_results
+{
+  mlp::vec<T, 7> ax;
+  mlp::mat<T, 7, 5> ab;
+  mlp::mat<T, 13, 7> at;
+};
+
+template<typename T>
+constexpr auto kernel_products(const kernel_case<T>& k) -> kernel_results<T>
+{
+  using namespace mlp;
+  return {k.a * k.x, k.a * k.b, transpose(k.a)};
+}
+
+struct activation_results
+{
+  mlp::vec<double, 13> tanh;
+  mlp::vec<double, 13> relu;
+  mlp::vec<double, 13> sigmoid;
+  mlp::vec<double, 13> tanh_d;
+  mlp::vec<double, 13> sigmoid_d;
+};
+
+constexpr auto kernel_activations(const mlp::vec<double, 13>& x) -> activation_results
+{
+  using namespace mlp;
+  return {activation(act::Tanh, x), activation(act::ReLU, x), activation(act::Sigmoid, actmode::Table, x),
+    derivative(act::Tanh, x), derivative(act::Sigmoid, x)};
+}
+
+// runtime transposes and transposed products of a M x N matrix against the plain loops,
+// P columns on the right of a^T * b take several bands of c when they are wide enough
+template<std::size_t M, std::size_t N, std::size_t P>
+auto transposed_match() -> bool
+{
+  using namespace mlp;
+
+  const auto a = std::make_unique<mat<double, M, N>>();
+  const auto b = std::make_unique<mat<double, M, P>>();
+  auto x = vec<double, M>{};
+  for (std::size_t i = 0; i < M; ++i)
+  {
+    x[i] = 1.0 / static_cast<double>(i + 2);
+    for (std::size_t j = 0; j < N; ++j)
+      (*a)[i][j] = 1.0 / static_cast<double>(i * N + j + 1);
+    for (std::size_t p = 0; p < P; ++p)
+      (*b)[i][p] = .5 - 1.0 / static_cast<double>(i * P + p + 3);
+  }
+
+  const auto a_t = std::make_unique<mat<double, N, M>>(transpose(*a));
+  const auto y = tmul(*a, x);
+  const auto c = std::make_unique<mat<double, N, P>>(tmul(*a, *b));
+  for (std::size_t j = 0; j < N; ++j)
+  {
+    auto y_j = 0.0;
+    for (std::size_t i = 0; i < M; ++i)
+    {
+      if ((*a_t)[j][i] != (*a)[i][j])
+        return false;
+      y_j = y_j + (*a)[i][j] * x[i];
+    }
+    if (y[j] != y_j)
+      return false;
+
+    for (std::size_t p = 0; p < P; ++p)
+    {
+      auto c_jp = 0.0;
+      for (std::size_t i = 0; i < M; ++i)
+        c_jp = c_jp + (*a)[i][j] * (*b)[i][p];
+      if ((*c)[j][p] != c_jp)
+        return false;
+    }
+  }
+  return true;
+}
+
+template<std::size_t N>
+auto transposed_inplace_match() -> bool
+{
+  using namespace mlp;
+
+  const auto a = std::make_unique<mat<double, N, N>>();
+  for (std::size_t i = 0; i < N; ++i)
+    for (std::size_t j = 0; j < N; ++j)
+      (*a)[i][j] = static_cast<double>(i * N + j);
+  transpose_inplace(*a);
+  for (std::size_t i = 0; i < N; ++i)
+    for (std::size_t j = 0; j < N; ++j)
+      if ((*a)[i][j] != static_cast<double>(j * N + i))
+        return false;
+  return true;
+}
+} // namespace
+
+// conversions and arithmetic saturate at the range of the format rather than at the
+// range of the integer holding it
+static_assert([]{
+  using q = mlp::fixed<7, 16>;
+  const auto hi = q::from_raw(q::max);
+  const auto lo = q::from_raw(q::min);
+  return q{1000.0} == hi && q{-1000} == lo && q::from_raw(std::int64_t{1} << 30) == hi &&
+    q{100} + q{100} == hi && q{-100} - q{100} == lo && q{100} + q{27} == q{127} &&
+    q{200} * q{200} == hi && q{-200} * q{200} == lo && q{1} / q{} == hi && -lo == hi;
+}());
+
+static_assert(static_cast<double>(mlp::fixed<3, 4>{10.0}) == 7.9375 && static_cast<double>(mlp::fixed<3, 4>{-10.0}) == -8.0);
+
+// the policies give the results of the plain functions, fold is a left fold with seq and
+// a pairwise reduce otherwise
+static_assert([]{
+  auto x = mlp::vec<double, 40>{};
+  for (std::size_t i = 0; i < x.size(); ++i)
+    x[i] = 1.0 / static_cast<double>(i + 1);
+  const auto sq = [](double x_i){ return x_i * x_i; };
+
+  const auto y = mlp::fmap(sq, x);
+  const auto y_seq = mlp::fmap(mlp::execution::seq, sq, x);
+  const auto y_unseq = mlp::fmap(mlp::execution::unseq, sq, x);
+  const auto y_par = mlp::fmap(mlp::execution::par, sq, x);
+  for (std::size_t i = 0; i < x.size(); ++i)
+    if (y_seq[i] != y[i] || y_unseq[i] != y[i] || y_par[i] != y[i])
+      return false;
+
+  return mlp::fold(mlp::execution::seq, std::minus{}, 0.0, x) == mlp::fold(std::minus{}, 0.0, x) &&
+    mlp::fold(mlp::execution::unseq, std::plus{}, 0.0, x) == mlp::reduce(std::plus{}, 0.0, x) &&
+    mlp::fold(mlp::execution::par, std::plus{}, 0.0, x) == mlp::reduce(std::plus{}, 0.0, x);
+}());
+
+// the in-place operations give the results of the ones that return a new value, also
+// when the output of zip_into is one of its inputs
+static_assert([]{
+  using namespace mlp;
+
+  const auto a = vec<double, 5>{1.0, -2.0, 3.5, 0.25, -0.5};
+  const auto b = vec<double, 5>{0.5, 4.0, -1.0, 2.0, 8.0};
+  const auto twice = [](double x){ return 2.0 * x; };
+  const auto mad = [](double x, double y){ return x * y + x; };
+
+  auto f = a;
+  fmap_inplace(twice, f);
+  auto z = vec<double, 5>{};
+  zip_into(mad, a, b, z);
+  auto z_a = a;
+  zip_into(mad, z_a, b, z_a);
+  auto z_b = b;
+  zip_into(mad, a, z_b, z_b);
+  auto sum = a;
+  sum += b;
+  auto diff = a;
+  diff -= b;
+  auto scaled = a;
+  scaled *= 3.0;
+
+  const auto f_ = fmap(twice, a);
+  const auto z_ = zip(mad, a, b);
+  const auto sum_ = a + b;
+  const auto diff_ = a - b;
+  const auto scaled_ = a * 3.0;
+  for (std::size_t i = 0; i < a.size(); ++i)
+    if (f[i] != f_[i] || z[i] != z_[i] || z_a[i] != z_[i] || z_b[i] != z_[i] ||
+        sum[i] != sum_[i] || diff[i] != diff_[i] || scaled[i] != scaled_[i])
+      return false;
+  return true;
+}());
+
+static_assert([]{
+  using namespace mlp;
+
+  const auto a = mat<double, 2, 3>{{{1.0, 2.0, 3.0}, {-4.0, 0.5, 6.0}}};
+  const auto b = mat<double, 2, 3>{{{0.25, -1.0, 2.0}, {3.0, 4.0, -0.5}}};
+  const auto mad = [](double x, double y){ return x * y + x; };
+
+  auto f = a;
+  fmap_inplace([](double x){ return -x; }, f);
+  auto z = a;
+  zip_into(mad, z, b, z);
+  auto sum = a;
+  sum += b;
+  auto diff = a;
+  diff -= b;
+  auto scaled = a;
+  scaled *= -2.0;
+
+  const auto z_ = zip(mad, a, b);
+  const auto sum_ = a + b;
+  const auto diff_ = a - b;
+  const auto scaled_ = a * -2.0;
+  for (std::size_t i = 0; i < 2; ++i)
+    for (std::size_t j = 0; j < 3; ++j)
+      if (f[i][j] != -a[i][j] || z[i][j] != z_[i][j] || sum[i][j] != sum_[i][j] ||
+          diff[i][j] != diff_[i][j] || scaled[i][j] != scaled_[i][j])
+        return false;
+  return true;
+}());
+
+// a learner stepping through the rows of every epoch trains the network of fit
+static_assert([]{
+  auto l = mlp::learner{xor_net, mlp::fitparms{1, .5, mlp::lossf::LogLoss}};
+  for (int epoch = 0; epoch < 20; ++epoch)
+    l.update_batch(xor_x, xor_y);
+
+  const auto y = xor_x >> l.net;
+  const auto y_fit = xor_x >> mlp::fit(xor_net, mlp::fitparms{20, .5, mlp::lossf::LogLoss}, xor_x, xor_y);
+  return l.steps == 80 && y[0][0] == y_fit[0][0] && y[1][0] == y_fit[1][0] && y[2][0] == y_fit[2][0] && y[3][0] == y_fit[3][0];
+}());
+
+// partial evaluation of the first layer agrees with the full forward pass
+static_assert([]{
+  const auto p = mlp::share(net, mlp::vec<double, 3>{.3, -.1, .7});
+  return distance(mlp::vec<double, 1>{.2} >> p, mlp::vec<double, 4>{.3, -.1, .7, .2} >> net);
+}() <= 1e-15);
+
+// incremental updates agree with the full forward pass of the changed input, exactly
+// after a refresh
+static_assert([]{
+  auto inc = mlp::track(net, mlp::vec<double, 4>{.3, -.1, .7, .2});
+  inc.update(2, .5).update(mlp::vec<std::size_t, 2>{0, 3}, mlp::vec<double, 2>{-.4, .9});
+
+  const auto y = mlp::vec<double, 4>{-.4, -.1, .5, .9} >> net;
+  const auto d = distance(inc.output(), y);
+  return d <= 1e-15 && distance(inc.refresh().output(), y) == 0.0;
+}());
+
+// sparse fit gives the weights of the dense fit on the same data
+static_assert([]{
+  const auto x = mlp::mat<double, 4, 4>{{{.5, 0, 0, -.3}, {0, .8, .1, 0}, {0, 0, -.6, .4}, {.2, 0, 0, .9}}};
+  const auto x_s = mlp::spmat<double, 4, 4, 8>{{0, 2, 4, 6, 8}, {0, 3, 1, 2, 2, 3, 0, 3}, {.5, -.3, .8, .1, -.6, .4, .2, .9}};
+  const auto y = mlp::mat<double, 4, 2>{{{1, 0}, {0, 1}, {1, 1}, {0, 0}}};
+  const auto par = mlp::fitparms{20, .1, mlp::lossf::LogLoss};
+  const auto sparse = mlp::fit(net, par, x_s, y);
+  const auto dense = mlp::fit(net, par, x, y);
+
+  auto d = std::max(distance(std::get<0>(sparse).b, std::get<0>(dense).b), distance(std::get<1>(sparse).b, std::get<1>(dense).b));
+  for (std::size_t o = 0; o < 3; ++o)
+    d = std::max(d, distance(std::get<0>(sparse).w[o], std::get<0>(dense).w[o]));
+  for (std::size_t o = 0; o < 2; ++o)
+    d = std::max(d, distance(std::get<1>(sparse).w[o], std::get<1>(dense).w[o]));
+  return d == 0.0;
+}());
+
+// rows of ids which are never looked up are left unchanged by training
+static_assert([]{
+  const auto fnet = mlp::fit(embedded, mlp::fitparms{10, .5, mlp::lossf::LogLoss}, ids, labels);
+  const auto& w = std::get<0>(fnet).w;
+  const auto& w_0 = std::get<0>(embedded).w;
+  return distance(w[4], w_0[4]) == 0.0 && distance(w[0], w_0[0]) > 0.0;
+}());
+
+// the online learner takes batches of id rows like fit does
+static_assert([]{
+  auto l = mlp::learner{embedded, mlp::fitparms{1, .5, mlp::lossf::LogLoss}};
+  l.update_batch(ids, labels).update(ids[0], labels[0]);
+
+  const auto fnet = mlp::fit(embedded, mlp::fitparms{1, .5, mlp::lossf::LogLoss}, ids, labels);
+  const auto& w = std::get<0>(l.net).w;
+  return l.steps == 4 && distance(w[4], std::get<0>(fnet).w[4]) == 0.0 && distance(w[2], std::get<0>(fnet).w[2]) == 0.0;
+}());
+
+// ids are pooled by the table and a step moves every looked up row by the same amount
+static_assert([]{
+  const auto x = mlp::vec<std::size_t, 2>{0, 2};
+  const auto y = x >> std::get<0>(embedded);
+
+  auto fnet = embedded;
+  mlp::backpropagate(fnet, mlp::fitparms{1, .5, mlp::lossf::LogLoss}, x, mlp::vec<double, 1>{1});
+  const auto& w = std::get<0>(fnet).w;
+  const auto& w_0 = std::get<0>(embedded).w;
+  auto step = w[0];
+  for (std::size_t d = 0; d < 3; ++d)
+    step[d] = (w[0][d] - w_0[0][d]) - (w[2][d] - w_0[2][d]);
+
+  return y[0] == (.1 + .7) * .5 && y[1] == (.2 - .8) * .5 && y[2] == (.3 + .9) * .5 &&
+    distance(step, mlp::vec<double, 3>{}) <= 1e-15 && distance(w[0], w_0[0]) > 0.0 &&
+    distance(w[1], w_0[1]) == 0.0 && distance(w[3], w_0[3]) == 0.0 && distance(w[4], w_0[4]) == 0.0;
+}());
+
+// the backward pass skipping zero deltas and inputs gives the weights of the dense one
+static_assert([]{
+  const auto par = mlp::fitparms{1, .1, mlp::lossf::LogLoss};
+  auto d = 0.0;
+  for (std::size_t n = 0; n < relu_x.size(); ++n)
+  {
+    auto fnet = relu_net;
+    mlp::backpropagate(fnet, par, relu_x[n], relu_y[n]);
+    const auto dnet = dense_step(relu_net, par, relu_x[n], relu_y[n]);
+    for (std::size_t o = 0; o < 4; ++o)
+      d = std::max(d, distance(std::get<0>(fnet).w[o], std::get<0>(dnet).w[o]));
+    d = std::max(d, distance(std::get<1>(fnet).w[0], std::get<1>(dnet).w[0]));
+    d = std::max(d, distance(std::get<1>(fnet).w[1], std::get<1>(dnet).w[1]));
+  }
+  return d <= 1e-15;
+}());
+
+static_assert(bin_error() <= 1e-15 && ste_error() == 0.0);
+
+// the decomposition of wide, tall and rank deficient weights reconstructs them from
+// orthonormal singular vectors
+static_assert(svd_error(low.w) <= 1e-12 && svd_error(mlp::transpose(low.w)) <= 1e-12);
+static_assert(svd_error(std::get<0>(net).w) <= 1e-12);
+
+// the rank is a constant expression to instantiate the factorization with, which keeps
+// the outputs of a layer of that rank
+constexpr auto low_rank = mlp::rank(low, 1.0 - 1e-9);
+static_assert(low_rank == 2);
+static_assert([]{
+  const auto x = mlp::vec<double, 6>{.3, -.1, .7, .2, -.5, .9};
+  return distance(x >> mlp::factorize<low_rank>(low), x >> low) <= 1e-12;
+}());
+
+// a flat buffer holds the network it was made of, forwards like it and accumulates the
+// gradients of the layers
+static_assert([]{
+  auto f = mlp::flat{net};
+  const auto x = mlp::vec<double, 4>{.3, -.1, .7, .2};
+  const auto y = mlp::vec<double, 2>{1, 0};
+
+  auto g = net;
+  mlp::unflatten(mlp::vec<double, 23>{}, g);
+  mlp::gradient(net, g, mlp::lossf::LogLoss, x, y);
+  mlp::gradient(f, mlp::lossf::LogLoss, x, y);
+
+  const auto back = f.net();
+  return distance(mlp::flatten(back), mlp::flatten(net)) == 0.0 &&
+    std::get<0>(back).a == mlp::act::Tanh && std::get<1>(back).a == mlp::act::Sigmoid &&
+    distance(x >> f, x >> net) <= 1e-15 && distance(f.g, mlp::flatten(g)) <= 1e-15;
+}());
+
+int main()
+{
+  using namespace mlp;
+
+  // fixed-point layers saturate at the range of the format at runtime
+  {
+    using q = fixed<7, 16>;
+    auto a = q{100};
+    a += q{100};
+    auto b = q{-200};
+    b *= q{200};
+    const auto l = layer<2, 1, q>{act::Linear, {{{q{100}, q{100}}}}, {q{}}};
+    const auto y = vec<q, 2>{q{1}, q{1}} >> l;
+    check(a == q::from_raw(q::max) && b == q::from_raw(q::min) && y[0] == a, "saturating fixed arithmetic");
+  }
+
+  // thread pool runs nested in tasks of the calling thread and of the workers
+  {
+    auto tp = detail::threadpool{2};
+    auto calls = std::atomic<std::size_t>{};
+    // the tasks yield so that the calling thread gets some of them too
+    tp.run(64, [&](std::size_t){
+      std::this_thread::sleep_for(std::chrono::microseconds{100});
+      tp.run(4, [&](std::size_t){ ++calls; });
+    });
+    check(calls == 256, "nested threadpool::run");
+
+    auto callers = std::vector<std::thread>{};
+    for (int t = 0; t < 4; ++t)
+      callers.emplace_back([&]{
+        tp.run(16, [&](std::size_t){
+          tp.run(4, [&](std::size_t){ ++calls; });
+        });
+      });
+    for (auto& c : callers)
+      c.join();
+    check(calls == 512, "concurrent nested threadpool::run");
+  }
+
+  // the first exception of a task reaches the caller once every task is done and the
+  // pool stays usable
+  {
+    auto tp = detail::threadpool{2};
+    auto calls = std::atomic<std::size_t>{};
+    auto thrown = false;
+    try
+    {
+      tp.run(64, [&](std::size_t i){
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+        ++calls;
+        if (i % 8 == 3)
+          throw std::runtime_error("task");
+      });
+    }
+    catch (const std::runtime_error&)
+    {
+      thrown = true;
+    }
+    check(thrown && calls == 64, "exception thrown by a threadpool task");
+
+    tp.run(4, [&](std::size_t){ ++calls; });
+    check(calls == 68, "threadpool::run after an exception");
+  }
+
+  // policies over extents split into several chunks of the pool
+  {
+    auto x = vec<double, 3 * grain + 5>{};
+    for (std::size_t i = 0; i < x.size(); ++i)
+      x[i] = static_cast<double>(i % 7);
+    const auto sq = [](double x_i){ return x_i * x_i; };
+
+    const auto y = fmap(execution::seq, sq, x);
+    const auto y_par = fmap(execution::par, sq, x);
+    const auto y_unseq = fmap(execution::unseq, sq, x);
+    check(std::equal(y.begin(), y.end(), y_par.begin()) && std::equal(y.begin(), y.end(), y_unseq.begin()), "fmap with policies");
+
+    // the sums of small integers are exact in any order
+    const auto s = fold(execution::seq, std::plus{}, 0.0, x);
+    check(s == fold(execution::unseq, std::plus{}, 0.0, x) && s == fold(execution::par, std::plus{}, 0.0, x), "fold with policies");
+
+    const auto m = mat<double, 64, 2 * grain / 64>{};
+    const auto m_par = fmap(execution::par, [](double m_ij){ return m_ij + 1.0; }, m);
+    check(m_par[0][0] == 1.0 && m_par[63][m_par[63].size() - 1] == 1.0, "mat fmap with a parallel policy");
+  }
+
+  // parallel reductions nested in a parallel fmap run on the thread of the task
+  {
+    const auto x = vec<double, 3 * grain>{};
+    const auto y = fmap(execution::par, [&x](double){ return parallel_reduce(std::plus{}, 1.0, x); }, x);
+    check(y[0] == 1.0 && y[y.size() - 1] == 1.0, "parallel_reduce nested in a parallel fmap");
+  }
+
+  // readers of a model only see whole versions, in publication order, and keep them
+  // unchanged while they hold them
+  {
+    auto l = layer<16, 16>{act::Linear, {}, {}};
+    auto m = model{l};
+    auto stop = std::atomic<bool>{};
+    auto torn = std::atomic<std::size_t>{};
+    auto readers = std::vector<std::thread>{};
+    for (int t = 0; t < 4; ++t)
+      readers.emplace_back([&]{
+        for (auto last = 0.0; !stop;)
+        {
+          const auto s = m.acquire();
+          const auto v = s->b[0];
+          auto whole = v >= last;
+          std::this_thread::yield();
+          for (const auto& w_o : s->w)
+            whole = whole && std::all_of(w_o.begin(), w_o.end(), [v](double w_oi){ return w_oi == v; });
+          if (!whole || s->b[15] != v)
+            ++torn;
+          last = v;
+        }
+      });
+
+    for (std::size_t v = 1; v <= 2000; ++v)
+    {
+      for (auto& w_o : l.w)
+        w_o.fill(static_cast<double>(v));
+      l.b.fill(static_cast<double>(v));
+      m.publish(l);
+    }
+    stop = true;
+    for (auto& r : readers)
+      r.join();
+    check(torn == 0 && m.acquire()->b[0] == 2000.0, "model snapshots under concurrent publication");
+  }
+
+  // a learner publishing every epoch to a model which is read concurrently ends at the
+  // network of fit, exactly
+  {
+    auto l = learner{xor_net, fitparms{1, .5, lossf::LogLoss}};
+    auto m = model{l.net};
+    auto stop = std::atomic<bool>{};
+    auto reads = std::atomic<std::size_t>{};
+    auto reader = std::thread{[&]{
+      for (; !stop; ++reads)
+        static_cast<void>(xor_x >> m);
+    }};
+    while (reads == 0)
+      std::this_thread::yield();
+    for (int epoch = 0; epoch < 500; ++epoch)
+      m.publish(l.update_batch(xor_x, xor_y).net);
+    stop = true;
+    reader.join();
+
+    const auto y = xor_x >> m;
+    const auto y_fit = xor_x >> fit(xor_net, fitparms{500, .5, lossf::LogLoss}, xor_x, xor_y);
+    auto same = l.steps == 2000;
+    for (std::size_t n = 0; n < y.size(); ++n)
+      same = same && y[n][0] == y_fit[n][0];
+    check(same, "published learner matches fit");
+  }
+
+  // cached outputs are shared by inputs rounding to the same key and dropped once a new
+  // version of the model is published
+  {
+    auto m = model{xor_net};
+    const auto c = cache{m, 256, .01};
+    const auto x = vec<double, 2>{.3, .7};
+    const auto y = x >> xor_net;
+
+    const auto y_miss = x >> c;
+    const auto y_hit = x >> c;
+    const auto y_near = vec<double, 2>{.301, .699} >> c;
+    check(y_miss == y && y_hit == y && y_near == y && c.hits() == 2 && c.misses() == 1, "cache hits within a quantum");
+
+    static_cast<void>(vec<double, 2>{.32, .7} >> c);
+    check(c.hits() == 2 && c.misses() == 2, "cache miss outside of a quantum");
+
+    const auto fnet = fit(xor_net, fitparms{10, .5, lossf::LogLoss}, xor_x, xor_y);
+    m.publish(fnet);
+    const auto y_new = x >> c;
+    check(y_new == (x >> fnet) && c.misses() == 3 && m.acquire().version() == 1, "cache miss after a new version");
+
+    // inputs which cannot be rounded are keyed by their bits
+    const auto nan = std::numeric_limits<double>::quiet_NaN();
+    static_cast<void>(vec<double, 2>{nan, .7} >> c);
+    static_cast<void>(vec<double, 2>{nan, .7} >> c);
+    static_cast<void>(vec<double, 2>{1e300, .7} >> c);
+    const auto y_huge = vec<double, 2>{1e300, .7} >> c;
+    check(y_huge == (vec<double, 2>{1e300, .7} >> fnet) && c.hits() == 4 && c.misses() == 5, "cache keys of inputs out of range");
+  }
+
+  // partial evaluation at runtime agrees with the full forward pass
+  {
+    const auto x = mat<double, 2, 4>{{{.3, -.1, .7, .2}, {.3, -.1, .7, -.5}}};
+    const auto p = share(net, vec<double, 3>{.3, -.1, .7});
+    const auto y = mat<double, 2, 1>{{{.2}, {-.5}}} >> p;
+    const auto y_full = x >> net;
+    check(distance(y[0], y_full[0]) <= 1e-15 && distance(y[1], y_full[1]) <= 1e-15, "shared forward");
+  }
+
+  // online learning on id rows at runtime matches fit over the same batch
+  {
+    auto l = learner{embedded, fitparms{3, .5, lossf::LogLoss}};
+    for (int epoch = 0; epoch < 3; ++epoch)
+      l.update_batch(ids, labels);
+
+    const auto fnet = fit(embedded, fitparms{3, .5, lossf::LogLoss}, ids, labels);
+    auto d = 0.0;
+    for (std::size_t v = 0; v < 5; ++v)
+      d = std::max(d, distance(std::get<0>(l.net).w[v], std::get<0>(fnet).w[v]));
+    check(l.steps == 9 && d == 0.0 && distance(transpose(ids >> l.net)[0], transpose(ids >> fnet)[0]) == 0.0, "learner over embedding ids");
+  }
+
+  // ids past the end of the table are rejected before any row is read or updated
+  {
+    auto fnet = embedded;
+    auto thrown = 0;
+    try
+    {
+      static_cast<void>(vec<std::size_t, 2>{1, 5} >> fnet);
+    }
+    catch (const std::out_of_range&)
+    {
+      ++thrown;
+    }
+    try
+    {
+      backpropagate(fnet, fitparms{1, .5, lossf::LogLoss}, vec<std::size_t, 2>{1, 5}, vec<double, 1>{1});
+    }
+    catch (const std::out_of_range&)
+    {
+      ++thrown;
+    }
+    auto d = distance(std::get<1>(fnet).w[0], std::get<1>(embedded).w[0]);
+    for (std::size_t v = 0; v < 5; ++v)
+      d = std::max(d, distance(std::get<0>(fnet).w[v], std::get<0>(embedded).w[v]));
+    check(thrown == 2 && d == 0.0, "embedding ids out of range");
+  }
+
+  // the runtime backward pass skipping zero deltas and inputs gives the weights of the
+  // dense one, and the gradient it returns for a later layer is the dense one
+  {
+    const auto par = fitparms{1, .1, lossf::LogLoss};
+    auto d = 0.0;
+    for (std::size_t n = 0; n < relu_x.size(); ++n)
+    {
+      auto fnet = relu_net;
+      backpropagate(fnet, par, relu_x[n], relu_y[n]);
+      const auto dnet = dense_step(relu_net, par, relu_x[n], relu_y[n]);
+      for (std::size_t o = 0; o < 4; ++o)
+        d = std::max(d, distance(std::get<0>(fnet).w[o], std::get<0>(dnet).w[o]));
+      d = std::max(d, distance(std::get<1>(fnet).w[0], std::get<1>(dnet).w[0]));
+
+      // the hidden activations of the sample feed the second layer
+      auto gnet = relu_net;
+      const auto a = relu_x[n] >> std::get<0>(relu_net);
+      const auto z = std::get<1>(relu_net).w * a + std::get<1>(relu_net).b;
+      const auto delta = zip(std::multiplies{}, derivative(act::Sigmoid, z), derivative(lossf::LogLoss, relu_y[n], activation(act::Sigmoid, z)));
+      d = std::max(d, distance(backpropagate<1>(gnet, par, a, relu_y[n]), transpose(std::get<1>(relu_net).w) * delta));
+    }
+    check(d <= 1e-15, "sparse backward pass");
+  }
+
+  // binary layers forward and train at runtime like they do in constant evaluation
+  check(bin_error() <= 1e-15, "binlayer forward");
+  check(ste_error() == 0.0, "binlayer straight-through estimator");
+
+  // the runtime decomposition agrees with the compile-time one
+  check(svd_error(low.w) <= 1e-12 && svd_error(transpose(low.w)) <= 1e-12 && rank(low, 1.0 - 1e-9) == low_rank, "svd");
+
+  // l-bfgs with a short history that wraps around fits XOR
+  {
+    const auto y_fit = xor_x >> lbfgs<2>(xor_net, lbfgsparms{200, lossf::LogLoss}, xor_x, xor_y);
+    check(y_fit[0][0] < .01 && y_fit[1][0] > .99 && y_fit[2][0] > .99 && y_fit[3][0] < .01, "lbfgs");
+  }
+
+  // fitting the flat buffer by gradient steps matches fitting the layers
+  {
+    const auto x = mat<double, 4, 4>{{{.5, 0, 0, -.3}, {0, .8, .1, 0}, {0, 0, -.6, .4}, {.2, 0, 0, .9}}};
+    const auto y = mat<double, 4, 2>{{{1, 0}, {0, 1}, {1, 1}, {0, 0}}};
+    const auto par = fitparms{50, .1, lossf::LogLoss};
+    const auto f = fit(flat{net}, par, x, y);
+    check(distance(f.p, flatten(fit(net, par, x, y))) <= 1e-12 && distance(flatten(f.net()), f.p) == 0.0, "flat fit");
+  }
+
+  // a run killed while it trains resumes from its last snapshot to the network of an
+  // uninterrupted run, a fit without an interval neither reads nor writes the snapshot
+  {
+    using net_t = std::decay_t<decltype(net)>;
+    const auto x = mat<double, 4, 4>{{{.5, 0, 0, -.3}, {0, .8, .1, 0}, {0, 0, -.6, .4}, {.2, 0, 0, .9}}};
+    const auto y = mat<double, 4, 2>{{{1, 0}, {0, 1}, {1, 1}, {0, 0}}};
+    const auto par = fitparms{20000, .1, lossf::LogLoss, 1};
+    const auto path = "/tmp/mlp_test_" + std::to_string(::getpid()) + ".ckpt";
+
+    const auto pid = ::fork();
+    if (pid == 0)
+    {
+      auto c = checkpoint<net_t>{path};
+      static_cast<void>(fit(net, par, x, y, c));
+      std::_Exit(0);
+    }
+
+    auto c = checkpoint<net_t>{path};
+    auto saved = net;
+    while (!c.load(saved))
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+
+    const auto fnet = fit(net, par, x, y, c);
+    check(distance(flatten(fnet), flatten(fit(net, par, x, y))) == 0.0 && c.load(saved) == par.epochs, "fit resumed after a kill");
+
+    const auto fresh = fit(net, fitparms{3, .1, lossf::LogLoss}, x, y, c);
+    check(distance(flatten(fresh), flatten(fit(net, fitparms{3, .1, lossf::LogLoss}, x, y))) == 0.0 && c.load(saved) == par.epochs, "fit without checkpoint interval");
+
+    // the rows of the embedding table round trip, the pooling and the activations are the
+    // ones of the network loaded into
+    auto e = checkpoint<std::decay_t<decltype(embedded)>>{path};
+    e.save(embedded, 7);
+    e.wait();
+    auto loaded = std::decay_t<decltype(embedded)>{};
+    std::get<0>(loaded).p = pooling::Mean;
+    std::get<1>(loaded).a = act::Sigmoid;
+    const auto epoch = e.load(loaded);
+    auto d = distance(std::get<1>(loaded).w[0], std::get<1>(embedded).w[0]);
+    for (std::size_t v = 0; v < 5; ++v)
+      d = std::max(d, distance(std::get<0>(loaded).w[v], std::get<0>(embedded).w[v]));
+    check(epoch == 7u && d == 0.0 && (ids >> loaded)[0] == (ids >> embedded)[0], "checkpoint of an embedding");
+
+    std::remove(path.c_str());
+    std::remove((path + ".tmp").c_str());
+  }
+
+  // validation errors reach the training thread and a fit without epochs keeps the network
+  {
+    const auto x = mat<double, 4, 4>{{{.5, 0, 0, -.3}, {0, .8, .1, 0}, {0, 0, -.6, .4}, {.2, 0, 0, .9}}};
+    const auto y = mat<double, 4, 2>{{{1, 0}, {0, 1}, {1, 1}, {0, 0}}};
+
+    auto c = checkpoint<std::decay_t<decltype(net)>>{"/nonexistent/net.ckpt"};
+    auto v = validator<std::decay_t<decltype(net)>>{x, y, lossf::LogLoss, &c};
+    auto l = learner{net, fitparms{1, .5, lossf::LogLoss}};
+    auto thrown = false;
+    try
+    {
+      for (std::size_t epoch = 1; epoch <= 8; ++epoch)
+      {
+        v.submit(l.update_batch(x, y).net, epoch);
+        v.wait();
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      }
+    }
+    catch (const std::system_error&)
+    {
+      thrown = true;
+    }
+    check(thrown, "checkpoint error rethrown by the validator");
+
+    auto w = validator<std::decay_t<decltype(net)>>{x, y, lossf::LogLoss};
+    const auto fnet = fit(net, fitparms{0, .5, lossf::LogLoss, 0, 2}, x, y, w);
+    check(distance(flatten(fnet), flatten(net)) == 0.0, "validated fit without epochs");
+  }
+
+  // the held-out set is forwarded in batches with a padded last one and the result is the
+  // one of forwarding its rows one at a time
+  {
+    auto l = layer<64, 3>{act::Tanh, {}, {.1, -.2, .3}};
+    for (std::size_t o = 0; o < 3; ++o)
+      for (std::size_t i = 0; i < 64; ++i)
+        l.w[o][i] = static_cast<double>((o * 7 + i * 3) % 11) / 44.0 - .125;
+    const auto vnet = l + layer<3, 2>{act::Sigmoid, {{{.4, .5, -.6}, {.7, -.8, .9}}}, {-.1, .1}};
+
+    const auto x = std::make_unique<mat<double, 300, 64>>();
+    auto y = mat<double, 300, 2>{};
+    for (std::size_t n = 0; n < 300; ++n)
+    {
+      for (std::size_t i = 0; i < 64; ++i)
+        (*x)[n][i] = static_cast<double>((n * 13 + i * 5) % 17) / 17.0 - .5;
+      y[n] = {static_cast<double>(n % 2), static_cast<double>(n / 2 % 2)};
+    }
+
+    auto losses = std::vector<double>(300);
+    auto hits = 0.0;
+    for (std::size_t n = 0; n < 300; ++n)
+    {
+      const auto y_n = (*x)[n] >> vnet;
+      losses[n] = loss(lossf::LogLoss, y[n], y_n);
+      hits += (y_n[0] < y_n[1]) == (y[n][0] < y[n][1]) ? 1.0 : 0.0;
+    }
+    auto plus = std::plus{};
+    const auto mean = detail::pairwise<double>(plus, losses.data(), losses.size()) / 300.0;
+
+    auto v = validator<std::decay_t<decltype(vnet)>>{*x, y, lossf::LogLoss};
+    v.submit(vnet, 1);
+    v.wait();
+    const auto r = v.last();
+    check(r && r->epoch == 1 && r->loss - mean <= 1e-12 && mean - r->loss <= 1e-12 && r->accuracy == hits / 300.0, "batched validation");
+  }
+
+  // a scoped crossover is seen by its own thread only, nests and is restored when it ends
+  {
+    const auto shared = blas::crossover();
+    {
+      const auto kernels = detail::scoped_crossover{std::numeric_limits<std::size_t>::max()};
+      {
+        const auto all = detail::scoped_crossover{0};
+        auto other = std::size_t{1};
+        std::thread([&]{ other = blas::crossover(); }).join();
+        check(blas::crossover() == 0 && other == shared, "scoped crossover is thread-local");
+      }
+      check(blas::crossover() == std::numeric_limits<std::size_t>::max(), "nested scoped crossover");
+    }
+    check(blas::crossover() == shared, "scoped crossover restored");
+  }
+
+  // a resident copy forwards like the network from 2 MiB aligned storage whichever pages
+  // the system gives it, and a lock either holds or fails cleanly
+  {
+    const auto r = resident<std::decay_t<decltype(xor_net)>>{xor_net};
+    const auto& s = r.stats();
+    check(reinterpret_cast<std::uintptr_t>(&*r) % (std::size_t{2} << 20) == 0, "resident alignment");
+    check(!s.locked && s.bytes == sizeof(xor_net) && s.load.major >= 0 && s.warmup.major >= 0, "resident stats");
+    for (const auto& x_n : xor_x)
+    {
+      const auto y = x_n >> r;
+      check(y[0] == (x_n >> xor_net)[0], "resident forward");
+    }
+
+    // larger than a huge page
+    using wide_t = ::mlp::mlp<layer<512, 600>>;
+    const auto wide = std::make_unique<wide_t>();
+    std::get<0>(*wide).a = act::Tanh;
+    for (std::size_t o = 0; o < 600; ++o)
+      std::get<0>(*wide).w[o][o % 512] = .5;
+    auto locked = std::unique_ptr<resident<wide_t>>{};
+    auto refused = false;
+    try
+    {
+      locked = std::make_unique<resident<wide_t>>(*wide, true);
+    }
+    catch (const std::system_error&)
+    {
+      refused = true;
+    }
+    check(refused != (locked && locked->stats().locked), "resident lock holds or throws");
+
+    const auto unlocked = resident<wide_t>{*wide};
+    auto x = vec<double, 512>{};
+    x[7] = 1.0;
+    const auto y = x >> unlocked;
+    check(y[7] == (x >> *wide)[7] && y[7] != 0.0 && y[519] == y[7], "resident forward of a huge page sized network");
+  }
+
+  // the runtime kernels sum in the order of the loops of constant evaluation, so both give
+  // the same bits for floating and fixed point
+  {
+    constexpr auto k_d = kernel_operands<double>();
+    constexpr auto k_f = kernel_operands<float>();
+    constexpr auto k_q = kernel_operands<fixed<7, 16>>();
+    constexpr auto ce_d = kernel_products(k_d);
+    constexpr auto ce_f = kernel_products(k_f);
+    constexpr auto ce_q = kernel_products(k_q);
+    constexpr auto ce_act = kernel_activations(k_d.x);
+
+    const auto rt_d = kernel_products(k_d);
+    const auto rt_f = kernel_products(k_f);
+    const auto rt_q = kernel_products(k_q);
+    const auto rt_act = kernel_activations(k_d.x);
+    check(same(ce_d.ax, rt_d.ax) && same(ce_d.ab, rt_d.ab) && same(ce_d.at, rt_d.at), "double kernels match constant evaluation");
+    check(same(ce_f.ax, rt_f.ax) && same(ce_f.ab, rt_f.ab) && same(ce_f.at, rt_f.at), "float kernels match constant evaluation");
+    check(same(ce_q.ax, rt_q.ax) && same(ce_q.ab, rt_q.ab) && same(ce_q.at, rt_q.at), "fixed kernels match constant evaluation");
+    check(same(ce_act.tanh, rt_act.tanh) && same(ce_act.relu, rt_act.relu) && same(ce_act.sigmoid, rt_act.sigmoid) &&
+      same(ce_act.tanh_d, rt_act.tanh_d) && same(ce_act.sigmoid_d, rt_act.sigmoid_d), "activation kernels match constant evaluation");
+  }
+
+  // tuned products split over the pool from inside tasks of the pool, candidates of the
+  // autotuner are not seen by other threads
+  {
+    auto a = mat<double, 64, 64>{};
+    auto x = vec<double, 64>{};
+    for (std::size_t i = 0; i < 64; ++i)
+    {
+      x[i] = .01 * static_cast<double>(i);
+      for (std::size_t j = 0; j < 64; ++j)
+        a[i][j] = static_cast<double>((i * 31 + j * 17) % 13) - 6.0;
+    }
+    const auto y = a * x;
+
+    tune::set(64, 64, 1, {2, 0, 2});
+    const auto z = vec<double, 2 * grain>{};
+    const auto y_par = fmap(execution::par, [&](double){ return (a * x)[63]; }, z);
+    check(y_par[0] == y[63] && y_par[y_par.size() - 1] == y[63], "tuned product in a parallel fmap");
+
+    auto seen = tiling{};
+    auto live = tiling{};
+    auto forced = std::size_t{};
+    auto shared = std::size_t{};
+    detail::timed(64, 64, 1, {8, 0, 1}, [&]{
+      seen = detail::tuned(64, 64, 1);
+      live = tune::get(64, 64, 1);
+      forced = blas::crossover();
+      std::thread([&]{ shared = blas::crossover(); }).join();
+    });
+    check(seen.rows == 8 && live.rows == 2 && tune::get(64, 64, 1).rows == 2, "autotuner candidates are private");
+    check(forced == std::numeric_limits<std::size_t>::max() && shared == blas::crossover() && shared != forced, "autotuner crossover is private");
+
+    // the published tunings round trip through the file, a file that cannot be written throws
+    const auto path = "/tmp/mlp_test_" + std::to_string(::getpid()) + ".tune";
+    tune::save(path);
+    tune::set(64, 64, 1, {});
+    check(tune::load(path) && tune::get(64, 64, 1).rows == 2 && tune::get(64, 64, 1).threads == 2, "tunings round trip");
+    std::remove(path.c_str());
+    auto thrown = false;
+    try
+    {
+      tune::save("/nonexistent/mlp.tune");
+    }
+    catch (const std::system_error&)
+    {
+      thrown = true;
+    }
+    check(thrown, "failed tunings save throws");
+    tune::set(64, 64, 1, {});
+  }
+
+  // transposes and transposed products of shapes that are not multiples of the blocks
+  check(transposed_match<7, 13, 3>() && transposed_match<33, 33, 33>() && transposed_match<100, 37, 5>() &&
+    transposed_match<129, 130, 300>() && transposed_match<200, 2, 1>(), "transposed shapes");
+  check(transposed_inplace_match<7>() && transposed_inplace_match<33>() && transposed_inplace_match<100>() &&
+    transposed_inplace_match<129>() && transposed_inplace_match<130>() && transposed_inplace_match<200>(), "transposed in place shapes");
+
+  // batches forwarded in fused chunks agree with rows forwarded one at a time, exactly
+  // unless CBLAS computes the products
+  {
+    auto l = layer<64, 64>{act::Tanh, {}, {}};
+    for (std::size_t o = 0; o < 64; ++o)
+    {
+      for (std::size_t i = 0; i < 64; ++i)
+        l.w[o][i] = static_cast<double>((o * 37 + i * 11) % 17) / 64.0 - .125;
+      l.b[o] = static_cast<double>(o % 5) / 10.0 - .2;
+    }
+    const auto deep = l + l + l;
+
+    const auto x = std::make_unique<mat<double, 2048, 64>>();
+    for (std::size_t n = 0; n < x->size(); ++n)
+      for (std::size_t i = 0; i < 64; ++i)
+        (*x)[n][i] = static_cast<double>((n * 13 + i * 7) % 29) / 29.0 - .5;
+
+    tune::set(64, 64, 1, {2, 0, 2});
+    const auto y = std::make_unique<mat<double, 2048, 64>>(*x >> deep);
+    tune::set(64, 64, 1, {});
+
+    auto d = 0.0;
+    for (std::size_t n = 0; n < x->size(); ++n)
+      d = std::max(d, distance((*x)[n] >> deep, (*y)[n]));
+    check(d <= (blas::enabled() ? 1e-12 : 0.0), "fused batch forward");
+
+    // a partial last chunk, and any run of rows forwarded on its own, give the batch passed
+    // through one layer at a time
+    constexpr auto c = detail::chunk<vec<double, 64>, layer<64, 64>, layer<64, 64>, layer<64, 64>>;
+    constexpr auto n = 2 * c + 37;
+    const auto x_n = std::make_unique<mat<double, n, 64>>();
+    std::copy_n(x->begin(), n, x_n->begin());
+    const auto layered = std::make_unique<mat<double, n, 64>>(*x_n >> std::get<0>(deep) >> std::get<1>(deep) >> std::get<2>(deep));
+    const auto fused = std::make_unique<mat<double, n, 64>>(detail::forward_fused(*x_n, deep));
+    auto rows = std::make_unique<mat<double, n, 64>>();
+    detail::forward_rows<5>(*x_n, c - 2, deep, *rows);
+
+    auto d_fused = 0.0;
+    auto d_rows = 0.0;
+    auto untouched = true;
+    for (std::size_t k = 0; k < n; ++k)
+    {
+      d_fused = std::max(d_fused, distance((*fused)[k], (*layered)[k]));
+      if (c - 2 <= k && k < c + 3)
+        d_rows = std::max(d_rows, distance((*rows)[k], (*layered)[k]));
+      else
+        untouched = untouched && (*rows)[k] == vec<double, 64>{};
+    }
+    check(d_fused <= (blas::enabled() ? 1e-12 : 0.0) && d_rows <= (blas::enabled() ? 1e-12 : 0.0) && untouched, "fused forward of partial chunks");
+
+    auto w_bin = mat<double, 8, 64>{};
+    std::copy_n(l.w.begin(), 8, w_bin.begin());
+    const auto bin = ::mlp::mlp<binlayer<64, 8>>{binlayer<64, 8>{act::Sigmoid, w_bin, {}}};
+    const auto y_bin = detail::forward_fused(*x_n, bin);
+    const auto y_bin_layered = *x_n >> std::get<0>(bin);
+    auto d_bin = 0.0;
+    for (std::size_t k = 0; k < n; ++k)
+      d_bin = std::max(d_bin, distance(y_bin[k], y_bin_layered[k]));
+    check(d_bin == 0.0, "fused binary forward");
+  }
+
+  std::cout << (failures == 0 ? "all tests passed\n" : "some tests failed\n");
+  return failures == 0 ? 0 : 1;
+}
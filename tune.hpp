@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "blas.hpp"
+#include "mlp.hpp"
+#include "parallel.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+/*
+ * kernel autotuning
+ *
+ * times candidate tilings of the products of the layers of a network on the current
+ * machine and keeps the fastest of them in the tuning table. The table is persisted
+ * to a small text file together with the number of hardware threads and the data
+ * cache sizes it was measured with, so that a later start loads the winners instead
+ * of measuring again. A file written on a different machine is ignored and the
+ * defaults stay in effect
+ */
+namespace mlp::tune
+{
+struct result
+{
+  std::size_t m;
+  std::size_t n;
+  std::size_t p;
+  tiling t;
+  // nanoseconds per product with the winner and with the defaults
+  double tuned;
+  double defaults;
+};
+
+inline auto get(std::size_t m, std::size_t n, std::size_t p) -> tiling
+{
+  return detail::tunings().find(m, n, p);
+}
+
+// false if the shape is too large or the table is full
+inline auto set(std::size_t m, std::size_t n, std::size_t p, const tiling& t) -> bool
+{
+  return detail::tunings().store(m, n, p, t);
+}
+
+// hardware threads and L1d, L2 and L3 sizes the tunings are valid for
+inline auto machine() -> std::string
+{
+  const auto conf = [](int name){ return std::to_string(std::max(0L, ::sysconf(name))); };
+  return conf(_SC_NPROCESSORS_ONLN) + ' ' + conf(_SC_LEVEL1_DCACHE_SIZE) + ' ' +
+    conf(_SC_LEVEL2_CACHE_SIZE) + ' ' + conf(_SC_LEVEL3_CACHE_SIZE);
+}
+} // namespace mlp::tune
+
+namespace mlp::detail
+{
+inline auto candidates(std::size_t m, std::size_t p) -> std::vector<tiling>
+{
+  auto c = std::vector<tiling>{};
+  for (std::size_t threads = 1; threads <= pool().size() && threads <= m; threads *= 2)
+    if (p == 1)
+      for (const auto rows : {1, 2, 4, 8})
+        c.push_back({static_cast<std::size_t>(rows), 0, threads});
+    else
+      for (const auto cols : {0, 16, 64, 256})
+        if (static_cast<std::size_t>(cols) < p)
+          c.push_back({1, static_cast<std::size_t>(cols), threads});
+  return c;
+}
+
+// products are timed under a crossover local to this thread which keeps CBLAS out of them.
+// The candidate is looked up in a private table, only the winner is published
+template<typename F>
+auto timed(std::size_t m, std::size_t n, std::size_t p, const tiling& t, F&& f) -> double
+{
+  const auto kernels = scoped_crossover{std::numeric_limits<std::size_t>::max()};
+  auto candidate = tilings{};
+  candidate.store(m, n, p, t);
+  trial() = &candidate;
+  const auto ns = blas::detail::measure(f);
+  trial() = nullptr;
+  return ns;
+}
+
+template<typename L>
+struct tunable_layer
+{
+  static auto product() -> std::vector<tune::result> { return {}; }
+};
+} // namespace mlp::detail
+
+namespace mlp::tune
+{
+// times every candidate tiling of a mat<T, M, N> * mat<T, N, P> product, or of
+// mat<T, M, N> * vec<T, N> for P = 1, and keeps the fastest. Products smaller than
+// the tunable size always use the defaults
+template<typename T, std::size_t M, std::size_t N, std::size_t P = 1>
+auto product() -> result
+{
+  const auto a = std::make_unique<mat<T, M, N>>();
+  const auto b = std::make_unique<mat<T, N, P>>();
+  const auto c = std::make_unique<mat<T, M, P>>();
+  const auto x = std::make_unique<vec<T, N>>();
+  for (auto& a_i : *a)
+    a_i.fill(T(1));
+  for (auto& b_j : *b)
+    b_j.fill(T(1));
+  x->fill(T(1));
+
+  auto sink = T{};
+  const auto run = [&]{
+    if constexpr (P == 1)
+      sink = sink + (*a * *x)[M - 1];
+    else
+      *c = *a * *b;
+  };
+
+  const auto defaults = detail::timed(M, N, P, {}, run);
+  auto r = result{M, N, P, {}, defaults, defaults};
+  if (M * N * P >= detail::tunable)
+  {
+    for (const auto& t : detail::candidates(M, P))
+      if (const auto ns = detail::timed(M, N, P, t, run); ns < r.tuned)
+        r = {M, N, P, t, ns, defaults};
+    set(M, N, P, r.t);
+  }
+
+  [[maybe_unused]] const volatile auto kept = sink;
+  [[maybe_unused]] const volatile auto product = (*c)[M - 1][P - 1];
+  return r;
+}
+} // namespace mlp::tune
+
+namespace mlp::detail
+{
+template<typename T, std::size_t I, std::size_t O>
+struct tunable_layer<layer<I, O, T>>
+{
+  static auto product() -> std::vector<tune::result>
+  {
+    if constexpr (erasable<T, T>)
+      return {tune::product<T, O, I>()};
+    else
+      return {};
+  }
+};
+
+template<typename... Ls>
+auto tune_layers(const mlp<Ls...>*) -> std::vector<tune::result>
+{
+  auto r = std::vector<tune::result>{};
+  const auto append = [&r](const std::vector<tune::result>& r_l){ r.insert(r.end(), r_l.begin(), r_l.end()); };
+  (append(tunable_layer<Ls>::product()), ...);
+  return r;
+}
+} // namespace mlp::detail
+
+namespace mlp::tune
+{
+// tunes the product of every layer of the network and calibrates the CBLAS crossover
+// when it is enabled
+template<typename Net>
+auto network() -> std::vector<result>
+{
+  blas::calibrate();
+  return detail::tune_layers(static_cast<const Net*>(nullptr));
+}
+
+// writes the published tunings, throws std::system_error when the file cannot be
+// written, closed or moved into place
+inline void save(const std::string& path)
+{
+  const auto tmp = path + ".tmp";
+  auto f = std::unique_ptr<std::FILE, int (*)(std::FILE*)>{std::fopen(tmp.c_str(), "w"), &std::fclose};
+  if (!f)
+    throw std::system_error(errno, std::generic_category(), "tune open");
+
+  std::fprintf(f.get(), "mlptune 1\nmachine %s\n", machine().c_str());
+  if (blas::enabled())
+    std::fprintf(f.get(), "crossover %zu\n", blas::crossover());
+  detail::tunings().each([&](std::size_t m, std::size_t n, std::size_t p, const tiling& t){
+    std::fprintf(f.get(), "shape %zu %zu %zu %zu %zu %zu\n", m, n, p, t.rows, t.cols, t.threads);
+  });
+
+  if (std::fflush(f.get()) != 0 || std::ferror(f.get()))
+    throw std::system_error(errno, std::generic_category(), "tune write");
+  if (std::fclose(f.release()) != 0)
+    throw std::system_error(errno, std::generic_category(), "tune close");
+  if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    throw std::system_error(errno, std::generic_category(), "tune rename");
+}
+
+// false if the file is missing, malformed or was written on another machine
+inline auto load(const std::string& path) -> bool
+{
+  const auto f = std::unique_ptr<std::FILE, int (*)(std::FILE*)>{std::fopen(path.c_str(), "r"), &std::fclose};
+  if (!f)
+    return false;
+
+  auto line = std::string(256, '\0');
+  const auto next = [&]{ return std::fgets(line.data(), static_cast<int>(line.size()), f.get()) != nullptr; };
+  if (!next() || line.c_str() != std::string{"mlptune 1\n"})
+    return false;
+  if (!next() || line.c_str() != "machine " + machine() + '\n')
+    return false;
+
+  auto shapes = std::vector<result>{};
+  auto c = std::numeric_limits<std::size_t>::max();
+  while (next())
+  {
+    auto s = result{};
+    if (std::sscanf(line.c_str(), "crossover %zu", &c) == 1)
+      continue;
+    if (std::sscanf(line.c_str(), "shape %zu %zu %zu %zu %zu %zu", &s.m, &s.n, &s.p, &s.t.rows, &s.t.cols, &s.t.threads) != 6)
+      return false;
+    shapes.push_back(s);
+  }
+
+  for (const auto& s : shapes)
+    set(s.m, s.n, s.p, s.t);
+  if (blas::enabled() && c != std::numeric_limits<std::size_t>::max())
+    blas::crossover(c);
+  return true;
+}
+
+// loads the tunings from the file or measures them for the network and writes the file,
+// returns the measurements or nothing when the file was loaded
+template<typename Net>
+auto load_or_tune(const std::string& path) -> std::vector<result>
+{
+  if (load(path))
+    return {};
+  auto r = network<Net>();
+  save(path);
+  return r;
+}
+} // namespace mlp::tune
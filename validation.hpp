@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2020-present, Andrei Yaskovets
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "checkpoint.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * validator definition
+ *
+ * evaluates snapshots of a network on a held-out set on a background thread, so that
+ * training only waits for a copy of the network. Samples are forwarded in batches on
+ * that thread, which runs the parallel loops it calls on its own instead of taking the
+ * thread pool away from training. Snapshots which are superseded before the validator
+ * gets to them are dropped. The snapshot with the lowest loss is kept and also saved to the
+ * checkpoint if one is given. Evaluation and checkpoint errors are rethrown by the next
+ * submit, wait or best_net. The held-out set and the checkpoint must outlive the validator
+ */
+namespace mlp
+{
+template<typename Net>
+class validator
+{
+  struct state
+  {
+    Net net;
+    std::size_t epoch;
+  };
+
+public:
+  struct result
+  {
+    std::size_t epoch;
+    double loss;
+    double accuracy;
+  };
+
+  template<typename X, typename T, std::size_t N, std::size_t O>
+  validator(const vec<X, N>& x, const mat<T, N, O>& y, lossf f, checkpoint<Net>* c = nullptr)
+    : evaluate{[&x, &y, f](const Net& net, std::size_t epoch){ return validate(net, epoch, x, y, f); }}
+    , c{c}
+    , worker{[this]{ work(); }}
+  {}
+
+  validator(const validator&) = delete;
+  auto operator=(const validator&) -> validator& = delete;
+
+  // evaluates the pending snapshot and stops the worker
+  ~validator()
+  {
+    {
+      const auto lock = std::lock_guard{mutex};
+      stop = true;
+    }
+    wake.notify_one();
+    worker.join();
+  }
+
+  // stages a copy of the network trained for the given number of epochs
+  void submit(const Net& net, std::size_t epoch)
+  {
+    {
+      const auto lock = std::lock_guard{mutex};
+      rethrow();
+      if (staged)
+      {
+        staged->net = net;
+        staged->epoch = epoch;
+      }
+      else
+        staged.reset(new state{net, epoch});
+      dirty = true;
+    }
+    wake.notify_one();
+  }
+
+  // waits until the last staged snapshot is evaluated
+  void wait()
+  {
+    auto lock = std::unique_lock{mutex};
+    done.wait(lock, [this]{ return !dirty && !busy; });
+    rethrow();
+  }
+
+  auto last() const -> std::optional<result>
+  {
+    const auto lock = std::lock_guard{mutex};
+    return latest;
+  }
+
+  auto best() const -> std::optional<result>
+  {
+    const auto lock = std::lock_guard{mutex};
+    return top;
+  }
+
+  // network of the best result, or net if there is none yet
+  auto best_net(const Net& net) -> Net
+  {
+    const auto lock = std::lock_guard{mutex};
+    rethrow();
+    return kept ? kept->net : net;
+  }
+
+private:
+  template<typename X, typename T, std::size_t N, std::size_t O>
+  static auto validate(const Net& net, std::size_t epoch, const vec<X, N>& x, const mat<T, N, O>& y, lossf f) -> result
+  {
+    // rows forwarded together, the last batch is padded by repeating the last row
+    constexpr auto rows = std::max(std::size_t{1}, std::min(N, std::size_t{65536} / std::max(sizeof(X), sizeof(vec<T, O>))));
+
+    // per-sample loss and hit reduced pairwise so that the result does not depend on the batches
+    auto losses = std::vector<double>(N);
+    auto hits = std::vector<double>(N);
+    auto x_b = vec<X, rows>{};
+    for (std::size_t b = 0; b < N; b += rows)
+    {
+      for (std::size_t k = 0; k < rows; ++k)
+        x_b[k] = x[std::min(b + k, N - 1)];
+      const auto y_b = x_b >> net;
+
+      for (std::size_t n = b; n < std::min(b + rows, N); ++n)
+      {
+        const auto& y_n = y_b[n - b];
+        losses[n] = static_cast<double>(loss(f, y[n], y_n));
+
+        auto hit = false;
+        if constexpr (O == 1)
+          hit = (y_n[0] < T(0.5)) == (y[n][0] < T(0.5));
+        else
+          hit = std::max_element(y_n.begin(), y_n.end()) - y_n.begin() == std::max_element(y[n].begin(), y[n].end()) - y[n].begin();
+        hits[n] = hit ? 1.0 : 0.0;
+      }
+    }
+
+    auto plus = std::plus{};
+    const auto mean = [&plus](const std::vector<double>& v){
+      return v.empty() ? 0.0 : detail::pairwise<double>(plus, v.data(), v.size()) / static_cast<double>(v.size());
+    };
+    return {epoch, mean(losses), mean(hits)};
+  }
+
+  void work()
+  {
+    const auto serial = detail::threadpool::serial{};
+    for (auto lock = std::unique_lock{mutex};;)
+    {
+      wake.wait(lock, [this]{ return stop || dirty; });
+      if (!dirty)
+        return;
+
+      std::swap(staged, evaluated);
+      dirty = false;
+      busy = true;
+      lock.unlock();
+
+      auto r = std::optional<result>{};
+      auto improved = false;
+      auto e = std::exception_ptr{};
+      try
+      {
+        r = evaluate(evaluated->net, evaluated->epoch);
+        improved = !top || r->loss < top->loss;
+        if (improved && c)
+          c->save(evaluated->net, r->epoch);
+      }
+      catch (...)
+      {
+        e = std::current_exception();
+      }
+
+      lock.lock();
+      if (e)
+        error = e;
+      else
+      {
+        latest = r;
+        if (improved)
+        {
+          top = r;
+          std::swap(evaluated, kept);
+        }
+      }
+      busy = false;
+      done.notify_all();
+    }
+  }
+
+  void rethrow()
+  {
+    if (error)
+      std::rethrow_exception(std::exchange(error, nullptr));
+  }
+
+  const std::function<result(const Net&, std::size_t)> evaluate;
+  checkpoint<Net>* const c;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::unique_ptr<state> staged;
+  std::unique_ptr<state> evaluated;
+  std::unique_ptr<state> kept;
+  std::optional<result> latest;
+  std::optional<result> top;
+  std::exception_ptr error;
+  bool dirty = false;
+  bool busy = false;
+  bool stop = false;
+  std::thread worker;
+};
+} // namespace mlp
+
+/*
+ * mlp training with validation
+ *
+ * every epoch is validated while the next one trains. Training stops once the last
+ * validated epoch is fitparms::patience epochs past the best one, in which case the
+ * best validated network is returned
+ */
+namespace mlp
+{
+template<typename X, typename T, std::size_t N, std::size_t O, typename... Ls>
+auto fit(const mlp<Ls...>& net, const fitparms& par, const vec<X, N>& x, const mat<T, N, O>& y, validator<mlp<Ls...>>& v) -> mlp<Ls...>
+{
+  auto fnet = net;
+  for (std::size_t epoch = 1; epoch <= par.epochs; ++epoch)
+  {
+    for (std::size_t n = 0; n < N; ++n)
+      backpropagate(fnet, par, x[n], y[n]);
+    v.submit(fnet, epoch);
+
+    if (par.patience == 0)
+      continue;
+    const auto last = v.last();
+    const auto best = v.best();
+    if (last && best && last->epoch - best->epoch >= par.patience)
+      break;
+  }
+  v.wait();
+
+  if (par.patience == 0)
+    return fnet;
+  return v.best_net(net);
+}
+} // namespace mlp